@@ -0,0 +1,81 @@
+#include "Address.h"
+
+#include <boost/bind.hpp>
+
+#include "Callback.h"
+#include "CallbackHandler.h"
+#include "ResolverCache.h"
+#include "Socket.h"
+
+using namespace boost::asio::ip;
+
+Address::Address(const char* hostname, uint16_t port) : smHandle(0),
+														callback(NULL),
+														callbackArg(0),
+														refCount(1),
+														resolved(false),
+														endpoint(udp::v4(), port),
+														hostname(hostname) {
+}
+
+Address* Address::Create(const char* hostname, uint16_t port) {
+	Address* address = new Address(hostname, port);
+
+	// numeric addresses don't need the resolver
+	boost::system::error_code addressErrorCode;
+	boost::asio::ip::address numericAddress = boost::asio::ip::address::from_string(hostname, addressErrorCode);
+
+	if (!addressErrorCode) {
+		address->endpoint.address(numericAddress);
+		address->resolved.store(true, boost::memory_order_release);
+	}
+
+	return address;
+}
+
+void Address::Release() {
+	if (--refCount) return;
+
+	delete this;
+}
+
+void Address::Resolve(uint32_t socketId, HandlerLock* handlerLock, IPluginFunction* callback, int32_t callbackArg) {
+	this->callback = callback;
+	this->callbackArg = callbackArg;
+
+	AddRef();
+
+	if (IsResolved()) {
+		callbackHandler.AddCallback(new Callback(CallbackEvent_AddressResolved, socketId, this, 0));
+		delete handlerLock;
+		return;
+	}
+
+	try {
+		resolverCache.AsyncResolve(hostname.c_str(),
+								   boost::bind(&Address::ResolveHandler,
+											   this,
+											   socketId,
+											   handlerLock,
+											   _1,
+											   _2));
+	} catch (std::exception& e) {
+		callbackHandler.AddCallback(new Callback(CallbackEvent_AddressResolved, socketId, this, boost::asio::error::host_not_found));
+		delete handlerLock;
+	}
+}
+
+void Address::ResolveHandler(uint32_t socketId, HandlerLock* handlerLock, const boost::system::error_code& errorCode, ResolvedAddresses addresses) {
+	if (!errorCode) {
+		// udp sockets are created for IPv4 unless bound otherwise
+		AddressList::const_iterator it = addresses->begin();
+		while (it != addresses->end() && !it->is_v4()) it++;
+
+		endpoint.address(it != addresses->end() ? *it : addresses->front());
+		resolved.store(true, boost::memory_order_release);
+	}
+
+	// takes over the reference from Resolve()
+	callbackHandler.AddCallback(new Callback(CallbackEvent_AddressResolved, socketId, this, errorCode.value()));
+	delete handlerLock;
+}
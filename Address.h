@@ -0,0 +1,60 @@
+#ifndef INC_SEXT_ADDRESS_H
+#define INC_SEXT_ADDRESS_H
+
+#include <stdint.h>
+#include <string>
+#include <boost/asio.hpp>
+#include <boost/atomic.hpp>
+
+#include "sdk/smsdk_ext.h"
+#include "ResolverCache.h"
+
+class HandlerLock;
+
+/**
+ * ref-counted udp endpoint resolved once and used for any number of datagrams, backs the
+ * SocketAddress handle type
+ *
+ * The endpoint is written once by the resolver and read without locking after IsResolved()
+ * returned true.
+ */
+class Address {
+public:
+	/**
+	 * @return new address with a reference count of 1, numeric addresses are resolved already
+	 */
+	static Address* Create(const char* hostname, uint16_t port);
+
+	void AddRef() { refCount++; }
+	void Release();
+
+	/**
+	 * resolve the hostname in the background and report the result to socketId with an
+	 * address resolved callback, holds a reference until then
+	 *
+	 * @param handlerLock	lock on the socket, released once the callback has been queued
+	 * @param callback		plugin function to report to, kept with the address so concurrent
+	 *						requests through the same socket don't replace each other's
+	 * @param callbackArg	arg passed to callback
+	 */
+	void Resolve(uint32_t socketId, HandlerLock* handlerLock, IPluginFunction* callback, int32_t callbackArg);
+
+	bool IsResolved() const { return resolved.load(boost::memory_order_acquire); }
+	const boost::asio::ip::udp::endpoint& GetEndpoint() const { return endpoint; }
+
+	int32_t smHandle; // 0 once the handle has been freed
+	IPluginFunction* callback;
+	int32_t callbackArg;
+
+private:
+	Address(const char* hostname, uint16_t port);
+
+	void ResolveHandler(uint32_t socketId, HandlerLock* handlerLock, const boost::system::error_code& errorCode, ResolvedAddresses addresses);
+
+	boost::atomic<uint32_t> refCount;
+	boost::atomic<bool> resolved;
+	boost::asio::ip::udp::endpoint endpoint;
+	std::string hostname;
+};
+
+#endif
@@ -0,0 +1,86 @@
+#include "Buffer.h"
+
+#include <new>
+#include <cstring>
+
+#include "Pool.h"
+
+// size classes are powers of two from 2^BUFFER_MIN_SIZE_SHIFT up to 2^BUFFER_MAX_SIZE_SHIFT bytes
+#define BUFFER_MIN_SIZE_SHIFT 9
+#define BUFFER_MAX_SIZE_SHIFT 16
+#define BUFFER_SIZE_CLASSES (BUFFER_MAX_SIZE_SHIFT - BUFFER_MIN_SIZE_SHIFT + 1)
+
+static MemoryPool bufferPool512(sizeof(Buffer) + 512, 1024);
+static MemoryPool bufferPool1k(sizeof(Buffer) + 1024, 1024);
+static MemoryPool bufferPool2k(sizeof(Buffer) + 2048, 1024);
+static MemoryPool bufferPool4k(sizeof(Buffer) + 4096, 1024);
+static MemoryPool bufferPool8k(sizeof(Buffer) + 8192, 256);
+static MemoryPool bufferPool16k(sizeof(Buffer) + 16384, 256);
+static MemoryPool bufferPool32k(sizeof(Buffer) + 32768, 64);
+static MemoryPool bufferPool64k(sizeof(Buffer) + 65536, 64);
+
+static MemoryPool* const bufferPools[BUFFER_SIZE_CLASSES] = {
+	&bufferPool512, &bufferPool1k, &bufferPool2k, &bufferPool4k,
+	&bufferPool8k, &bufferPool16k, &bufferPool32k, &bufferPool64k,
+};
+
+Buffer* Buffer::Create(size_t capacity) {
+	int sizeClass = 0;
+
+	while (sizeClass < BUFFER_SIZE_CLASSES && ((size_t) 1 << (sizeClass + BUFFER_MIN_SIZE_SHIFT)) < capacity) {
+		sizeClass++;
+	}
+
+	if (sizeClass == BUFFER_SIZE_CLASSES) {
+		return new (::operator new(sizeof(Buffer) + capacity)) Buffer(capacity, -1);
+	}
+
+	size_t classCapacity = (size_t) 1 << (sizeClass + BUFFER_MIN_SIZE_SHIFT);
+	void* block = bufferPools[sizeClass]->Allocate(sizeof(Buffer) + classCapacity);
+
+	return new (block) Buffer(classCapacity, sizeClass);
+}
+
+Buffer* Buffer::Create(const char* data, size_t length) {
+	Buffer* buf = Create(length);
+
+	memcpy(buf->GetData(), data, length);
+	buf->SetLength(length);
+
+	return buf;
+}
+
+void Buffer::Release() {
+	if (--refCount) return;
+
+	int sizeClass = this->sizeClass;
+	size_t size = sizeof(Buffer) + capacity;
+
+	this->~Buffer();
+
+	if (sizeClass < 0) {
+		::operator delete(this);
+	} else {
+		bufferPools[sizeClass]->Free(this, size);
+	}
+}
+
+uint32_t Buffer::GetAllocations() {
+	uint32_t ret = 0;
+
+	for (int i=0; i<BUFFER_SIZE_CLASSES; i++) {
+		ret += bufferPools[i]->GetAllocations();
+	}
+
+	return ret;
+}
+
+uint32_t Buffer::GetHeapAllocations() {
+	uint32_t ret = 0;
+
+	for (int i=0; i<BUFFER_SIZE_CLASSES; i++) {
+		ret += bufferPools[i]->GetHeapAllocations();
+	}
+
+	return ret;
+}
@@ -0,0 +1,47 @@
+#ifndef INC_SEXT_BUFFER_H
+#define INC_SEXT_BUFFER_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <boost/atomic.hpp>
+
+/**
+ * ref-counted data buffer, allocated from size class pools and returned to them once the last
+ * reference has been released
+ *
+ * The data is stored right behind the object, buffers are passed between threads by handing
+ * over a reference.
+ */
+class Buffer {
+public:
+	/**
+	 * @return new buffer with a reference count of 1 and room for at least capacity bytes
+	 */
+	static Buffer* Create(size_t capacity);
+	/**
+	 * @return new buffer holding a copy of length bytes from data
+	 */
+	static Buffer* Create(const char* data, size_t length);
+
+	void AddRef() { refCount++; }
+	void Release();
+
+	char* GetData() { return reinterpret_cast<char*>(this + 1); }
+	const char* GetData() const { return reinterpret_cast<const char*>(this + 1); }
+	size_t GetCapacity() const { return capacity; }
+	size_t GetLength() const { return length; }
+	void SetLength(size_t length) { this->length = length; }
+
+	static uint32_t GetAllocations();
+	static uint32_t GetHeapAllocations();
+
+private:
+	Buffer(size_t capacity, int sizeClass) : refCount(1), capacity(capacity), length(0), sizeClass(sizeClass) {}
+
+	boost::atomic<uint32_t> refCount;
+	const size_t capacity;
+	size_t length;
+	const int sizeClass; // -1 if not pooled
+};
+
+#endif
@@ -2,6 +2,7 @@
 
 #include <assert.h>
 #include <string>
+#include <vector>
 #include <boost/asio.hpp>
 
 #include "Define.h"
@@ -11,53 +12,83 @@
 
 using namespace boost::asio::ip;
 
+MemoryPool Callback::pool(sizeof(Callback), 4096);
+
+void* Callback::operator new(size_t size) {
+	return pool.Allocate(size);
+}
+
+void Callback::operator delete(void* p, size_t size) {
+	pool.Free(p, size);
+}
+
 Callback::Callback(CallbackEvent callbackEvent,
-				   const void* socket) : callbackEvent(callbackEvent) {
-	assert(callbackEvent == CallbackEvent_Connect || callbackEvent == CallbackEvent_Disconnect || callbackEvent == CallbackEvent_SendQueueEmpty);
+				   uint32_t socketId) : callbackEvent(callbackEvent),
+										pendingNext(NULL),
+										batchNext(NULL) {
+	assert(callbackEvent == CallbackEvent_Connect || callbackEvent == CallbackEvent_Disconnect || callbackEvent == CallbackEvent_SendQueueEmpty || callbackEvent == CallbackEvent_SendQueueLow || callbackEvent == CallbackEvent_Bind);
 
-	socketWrapper = socketHandler.GetSocketWrapper(socket);
+	socketWrapper = socketHandler.GetSocketWrapper(socketId);
 }
 
 Callback::Callback(CallbackEvent callbackEvent,
-				   const void* socket,
-				   const char* data,
-				   size_t dataLength) : callbackEvent(callbackEvent) {
+				   uint32_t socketId,
+				   Buffer* data) : callbackEvent(callbackEvent),
+										pendingNext(NULL),
+										batchNext(NULL) {
 	assert(callbackEvent == CallbackEvent_Receive);
 
-	socketWrapper = socketHandler.GetSocketWrapper(socket);
-	additionalData[0] = new std::string(data, dataLength);
+	socketWrapper = socketHandler.GetSocketWrapper(socketId);
+	additionalData[0] = data;
 }
 
 Callback::Callback(CallbackEvent callbackEvent,
-				   const void* socket,
-				   const void* newSocket,
-	   			   const tcp::endpoint& remoteEndPoint) : callbackEvent(callbackEvent) {
+				   uint32_t socketId,
+				   uint32_t newSocketId,
+	   			   const tcp::endpoint& remoteEndPoint) : callbackEvent(callbackEvent),
+														  pendingNext(NULL),
+														  batchNext(NULL) {
 	assert(callbackEvent == CallbackEvent_Incoming);
 
-	socketWrapper = socketHandler.GetSocketWrapper(socket);
-	additionalData[0] = socketHandler.GetSocketWrapper(newSocket);
+	socketWrapper = socketHandler.GetSocketWrapper(socketId);
+	additionalData[0] = socketHandler.GetSocketWrapper(newSocketId);
 	additionalData[1] = new tcp::endpoint(remoteEndPoint);
 }
 
 Callback::Callback(CallbackEvent callbackEvent,
-				   const void* socket,
+				   uint32_t socketId,
+				   Address* address,
+				   int errorNumber) : callbackEvent(callbackEvent),
+									  pendingNext(NULL),
+									  batchNext(NULL) {
+	assert(callbackEvent == CallbackEvent_AddressResolved);
+
+	socketWrapper = socketHandler.GetSocketWrapper(socketId);
+	additionalData[0] = address;
+	this->errorNumber = errorNumber;
+}
+
+Callback::Callback(CallbackEvent callbackEvent,
+				   uint32_t socketId,
 				   SM_ErrorType errorType,
-				   int errorNumber) : callbackEvent(callbackEvent) {
+				   int errorNumber) : callbackEvent(callbackEvent),
+									  pendingNext(NULL),
+									  batchNext(NULL) {
 	assert(callbackEvent == CallbackEvent_Error);
 
-	socketWrapper = socketHandler.GetSocketWrapper(socket);
-	additionalData[0] = new SM_ErrorType(errorType);
-	additionalData[1] = new int(errorNumber);
+	socketWrapper = socketHandler.GetSocketWrapper(socketId);
+	this->errorType = errorType;
+	this->errorNumber = errorNumber;
 }
 
 Callback::~Callback() {
 	if (callbackEvent == CallbackEvent_Receive) {
-		delete (std::string*) additionalData[0];
+		((Buffer*) additionalData[0])->Release();
 	} else if (callbackEvent == CallbackEvent_Incoming) {
 		delete (tcp::endpoint*) additionalData[1];
-	} else if (callbackEvent == CallbackEvent_Error) {
-		delete (SM_ErrorType*) additionalData[0];
-		delete (int*) additionalData[1];
+		if (batchNext) delete batchNext;
+	} else if (callbackEvent == CallbackEvent_AddressResolved) {
+		((Address*) additionalData[0])->Release();
 	}
 }
 
@@ -74,11 +105,17 @@ bool Callback::IsExecutable() {
 				case CallbackEvent_Disconnect:
 					return (socket->disconnectCallback != NULL);
 				case CallbackEvent_Incoming:
-					return (socket->incomingCallback != NULL);
+					return (socket->incomingCallback != NULL || socket->incomingBatchCallback != NULL);
 				case CallbackEvent_Receive:
 					return (socket->receiveCallback != NULL);
 				case CallbackEvent_SendQueueEmpty:
 					return (socket->sendqueueEmptyCallback != NULL);
+				case CallbackEvent_SendQueueLow:
+					return (socket->sendqueueLowCallback != NULL);
+				case CallbackEvent_Bind:
+					return (socket->bindCallback != NULL);
+				case CallbackEvent_AddressResolved:
+					return true; // the address carries its own callback
 				case CallbackEvent_Error:
 					return (socket->errorCallback != NULL);
 				default:
@@ -95,11 +132,17 @@ bool Callback::IsExecutable() {
 				case CallbackEvent_Disconnect:
 					return (socket->disconnectCallback != NULL);
 				case CallbackEvent_Incoming:
-					return (socket->incomingCallback != NULL);
+					return (socket->incomingCallback != NULL || socket->incomingBatchCallback != NULL);
 				case CallbackEvent_Receive:
 					return (socket->receiveCallback != NULL);
 				case CallbackEvent_SendQueueEmpty:
 					return (socket->sendqueueEmptyCallback != NULL);
+				case CallbackEvent_SendQueueLow:
+					return (socket->sendqueueLowCallback != NULL);
+				case CallbackEvent_Bind:
+					return (socket->bindCallback != NULL);
+				case CallbackEvent_AddressResolved:
+					return true; // the address carries its own callback
 				case CallbackEvent_Error:
 					return (socket->errorCallback != NULL);
 				default:
@@ -119,6 +162,46 @@ bool Callback::IsValid() {
 	return true;
 }
 
+size_t Callback::GetDataLength() const {
+	if (callbackEvent != CallbackEvent_Receive) return 0;
+
+	return ((const Buffer*) additionalData[0])->GetLength();
+}
+
+bool Callback::Concatenate(const Callback* callback, size_t maxLength) {
+	assert(callbackEvent == CallbackEvent_Receive && callback->callbackEvent == CallbackEvent_Receive);
+	assert(socketWrapper == callback->socketWrapper);
+
+	Buffer* data = (Buffer*) additionalData[0];
+	const Buffer* appendData = (const Buffer*) callback->additionalData[0];
+	size_t length = data->GetLength() + appendData->GetLength();
+
+	if (length > maxLength) return false;
+
+	if (length >= data->GetCapacity()) {
+		// grow to the next size class to make room for the following callbacks as well, a merge
+		// only leaves the pools once the merged data itself doesn't fit them anymore
+		size_t capacity = data->GetCapacity() * 2;
+
+		if (capacity < length+1) capacity = length+1;
+		if (capacity > maxLength+1) capacity = maxLength+1;
+
+		Buffer* newData = Buffer::Create(capacity);
+		memcpy(newData->GetData(), data->GetData(), data->GetLength());
+		newData->SetLength(data->GetLength());
+
+		data->Release();
+		data = newData;
+		additionalData[0] = data;
+	}
+
+	memcpy(data->GetData() + data->GetLength(), appendData->GetData(), appendData->GetLength());
+	data->SetLength(length);
+	data->GetData()[length] = '\0';
+
+	return true;
+}
+
 void Callback::Execute() {
 	switch (socketWrapper->socketType) {
 		case SM_SocketType_Tcp: {
@@ -156,10 +239,15 @@ void Callback::ExecuteHelper() {
 
 			return;
 		case CallbackEvent_Incoming: {
+			if (socket->incomingBatchCallback) {
+				ExecuteIncomingBatch<SocketType>();
+				return;
+			}
+
 			if (!socket->incomingCallback) return;
 
 			Socket<SocketType>* socket2 = (Socket<SocketType>*) ((SocketWrapper*)additionalData[0])->socket;
-			socket2->smHandle = handlesys->CreateHandle(extension.socketHandleType, socketHandler.GetSocketWrapper(socket2), socket->incomingCallback->GetParentContext()->GetIdentity(), myself->GetIdentity(), NULL);
+			socket2->smHandle = handlesys->CreateHandle(extension.socketHandleType, (SocketWrapper*) additionalData[0], socket->incomingCallback->GetParentContext()->GetIdentity(), myself->GetIdentity(), NULL);
 
 			socket->incomingCallback->PushCell(socket->smHandle);
 			socket->incomingCallback->PushCell(socket2->smHandle);
@@ -171,19 +259,21 @@ void Callback::ExecuteHelper() {
 			return;
 		}
 		case CallbackEvent_Receive: {
-			if (!socket->receiveCallback) return;
+			Buffer* data = (Buffer*) additionalData[0];
+			size_t strLen = data->GetLength();
+
+			// account before executing, the plugin may close the socket in its callback
+			socket->ReceiveDelivered(strLen);
 
-			size_t strLen = ((std::string*) additionalData[0])->length();
-			char* tmp = new char[strLen+1];
-			memcpy(tmp, ((std::string*) additionalData[0])->c_str(), strLen+1);
+			if (!socket->receiveCallback) return;
 
+			// the buffer is \0 terminated, this is the only copy on the way to the plugin
 			socket->receiveCallback->PushCell(socket->smHandle);
-			socket->receiveCallback->PushStringEx(tmp, strLen+1, SM_PARAM_STRING_COPY|SM_PARAM_STRING_BINARY, 0);
+			socket->receiveCallback->PushStringEx(data->GetData(), strLen+1, SM_PARAM_STRING_COPY|SM_PARAM_STRING_BINARY, 0);
 			socket->receiveCallback->PushCell(strLen);
 			socket->receiveCallback->PushCell(socket->smCallbackArg);
 			socket->receiveCallback->Execute(NULL);
 
-			delete[] tmp;
 			return;
 		}
 		case CallbackEvent_SendQueueEmpty:
@@ -194,15 +284,73 @@ void Callback::ExecuteHelper() {
 			socket->sendqueueEmptyCallback->Execute(NULL);
 
 			return;
+		case CallbackEvent_SendQueueLow:
+			if (!socket->sendqueueLowCallback) return;
+
+			socket->sendqueueLowCallback->PushCell(socket->smHandle);
+			socket->sendqueueLowCallback->PushCell(socket->smCallbackArg);
+			socket->sendqueueLowCallback->Execute(NULL);
+
+			return;
+		case CallbackEvent_Bind:
+			if (!socket->bindCallback) return;
+
+			socket->bindCallback->PushCell(socket->smHandle);
+			socket->bindCallback->PushCell(socket->smCallbackArg);
+			socket->bindCallback->Execute(NULL);
+
+			return;
+		case CallbackEvent_AddressResolved: {
+			Address* address = (Address*) additionalData[0];
+
+			// the address handle has been freed in the meantime
+			if (!address->callback || !address->smHandle) return;
+
+			address->callback->PushCell(socket->smHandle);
+			address->callback->PushCell(address->smHandle);
+			address->callback->PushCell(errorNumber);
+			address->callback->PushCell(address->callbackArg);
+			address->callback->Execute(NULL);
+
+			return;
+		}
 		case CallbackEvent_Error:
 			if (!socket->errorCallback) return;
 
 			socket->errorCallback->PushCell(socket->smHandle);
-			socket->errorCallback->PushCell(*(SM_ErrorType*) additionalData[0]);
-			socket->errorCallback->PushCell(*(int*) additionalData[1]);
+			socket->errorCallback->PushCell(errorType);
+			socket->errorCallback->PushCell(errorNumber);
 			socket->errorCallback->PushCell(socket->smCallbackArg);
 			socket->errorCallback->Execute(NULL);
 
 			return;
 	}
 }
+
+template<class SocketType>
+void Callback::ExecuteIncomingBatch() {
+	Socket<SocketType>* socket = (Socket<SocketType>*) socketWrapper->socket;
+
+	std::vector<cell_t> newSocketHandles;
+	std::vector<cell_t> remotePorts;
+	std::string remoteIPs;
+
+	for (Callback* cb = this; cb; cb = cb->batchNext) {
+		Socket<SocketType>* socket2 = (Socket<SocketType>*) ((SocketWrapper*)cb->additionalData[0])->socket;
+		socket2->smHandle = handlesys->CreateHandle(extension.socketHandleType, (SocketWrapper*) cb->additionalData[0], socket->incomingBatchCallback->GetParentContext()->GetIdentity(), myself->GetIdentity(), NULL);
+
+		if (!remoteIPs.empty()) remoteIPs += ' ';
+		remoteIPs += ((typename SocketType::endpoint*)cb->additionalData[1])->address().to_string();
+
+		newSocketHandles.push_back(socket2->smHandle);
+		remotePorts.push_back(((typename SocketType::endpoint*)cb->additionalData[1])->port());
+	}
+
+	socket->incomingBatchCallback->PushCell(socket->smHandle);
+	socket->incomingBatchCallback->PushArray(&newSocketHandles[0], newSocketHandles.size());
+	socket->incomingBatchCallback->PushString(remoteIPs.c_str());
+	socket->incomingBatchCallback->PushArray(&remotePorts[0], remotePorts.size());
+	socket->incomingBatchCallback->PushCell(newSocketHandles.size());
+	socket->incomingBatchCallback->PushCell(socket->smCallbackArg);
+	socket->incomingBatchCallback->Execute(NULL);
+}
@@ -1,50 +1,82 @@
 #ifndef INC_SEXT_CALLBACK_H
 #define INC_SEXT_CALLBACK_H
 
+#include <stdint.h>
 #include <string>
 #include <boost/asio.hpp>
 
+#include "Address.h"
+#include "Buffer.h"
+#include "CallbackQueue.h"
 #include "Define.h"
+#include "Pool.h"
 
 struct SocketWrapper;
 
-class Callback {
+class Callback : public CallbackQueueNode {
 public:
 	/**
-	 * construct a connect, disconnect or sendqueueempty callback
+	 * construct a connect, disconnect, sendqueueempty or sendqueuelow callback
 	 */
-	Callback(CallbackEvent callbackEvent, const void* socket);
+	Callback(CallbackEvent callbackEvent, uint32_t socketId);
 
 	/**
-	 * construct a receive callback
+	 * construct a receive callback, takes over the reference to data
 	 */
-	Callback(CallbackEvent callbackEvent, const void* socket, const char* data, size_t dataLength);
+	Callback(CallbackEvent callbackEvent, uint32_t socketId, Buffer* data);
 
 	/**
 	 * construct an incoming callback
 	 */
-	Callback(CallbackEvent callbackEvent, const void* socket, const void* newSocket, const boost::asio::ip::tcp::endpoint& remoteEndPoint);
+	Callback(CallbackEvent callbackEvent, uint32_t socketId, uint32_t newSocketId, const boost::asio::ip::tcp::endpoint& remoteEndPoint);
+
+	/**
+	 * construct an address resolved callback, takes over the reference to address
+	 */
+	Callback(CallbackEvent callbackEvent, uint32_t socketId, Address* address, int errorNumber);
 
 	/**
 	 * construct an error callback
 	 */
-	Callback(CallbackEvent callbackEvent, const void* socket, SM_ErrorType errorType, int errorNumber);
+	Callback(CallbackEvent callbackEvent, uint32_t socketId, SM_ErrorType errorType, int errorNumber);
 
 	~Callback();
 
 	bool IsExecutable();
 	bool IsValid();
 
+	/**
+	 * @return length of the received data, 0 for callbacks without data
+	 */
+	size_t GetDataLength() const;
+
+	/**
+	 * append the data of another receive callback for the same socket
+	 *
+	 * @return false if the data would exceed maxLength, nothing will be appended in this case
+	 */
+	bool Concatenate(const Callback* callback, size_t maxLength);
+
 	void Execute();
 
+	static void* operator new(size_t size);
+	static void operator delete(void* p, size_t size);
+
+	static MemoryPool pool;
+
 	friend class CallbackHandler;
 
 private:
 	template<class SocketType> void ExecuteHelper();
+	template<class SocketType> void ExecuteIncomingBatch();
 
 	const CallbackEvent callbackEvent;
 	SocketWrapper* socketWrapper;
+	Callback* pendingNext;
+	Callback* batchNext; // further incoming callbacks passed to the batched incoming callback
 	const void* additionalData[2];
+	SM_ErrorType errorType;
+	int errorNumber;
 	
 //	volatile bool isExecuting;
 };
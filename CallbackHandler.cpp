@@ -1,60 +1,301 @@
 #include "CallbackHandler.h"
 
 #include <iostream>
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 
 #include "Callback.h"
+#include "SocketHandler.h"
 
-void CallbackHandler::AddCallback(Callback* callback) {
-	boost::mutex::scoped_lock l(callbackQueueMutex);
+using namespace boost::asio::ip;
+
+// bytes a socket with priority 1 may receive per round before the next socket is served
+#define CALLBACK_QUANTUM 16384
+
+// maximum number of incoming connections passed to a single batched incoming callback
+#define MAX_INCOMING_BATCH 64
 
-	if (!callback->IsValid()) {
+CallbackHandler::CallbackHandler() : readyHead(NULL),
+									 readyTail(NULL),
+									 callbacksPerFrame(0),
+									 callbackTimePerFrame(2000) {
+}
+
+void CallbackHandler::AddCallback(Callback* callback) {
+	if (!callback->socketWrapper) {
+		// the socket has been destroyed while the operation completed, nothing to report
+		delete callback;
+	} else if (!callback->IsValid()) {
 		std::cout << "[SERR] invalid callback (event=" << callback->callbackEvent << ")" << std::endl;
 		delete callback;
 	} else {
-		callbackQueue.push_back(callback);
+		callbackQueue.Push(callback);
 	}
 }
 
 void CallbackHandler::RemoveCallbacks(SocketWrapper* sw) {
-	boost::mutex::scoped_lock l(callbackQueueMutex);
-
-	for (std::deque<Callback*>::iterator it=callbackQueue.begin(); it!=callbackQueue.end(); ) {
-		if ((*it)->socketWrapper == sw) {
-			/*if (!(*it)->isExecuting)*/ delete *it;
-			it = callbackQueue.erase(it);
-		} else {
-			it++;
-		}
+	/*
+	 * the socket is gone, make sure everything it queued has been moved to its pending list
+	 *
+	 * Its handlers finished before, so their pushes got ahead of the marker even if they're not
+	 * linked yet.
+	 */
+	CallbackQueueNode marker;
+	callbackQueue.PushMarker(&marker);
+	FetchQueuedCallbacks(&marker);
+
+	while (Callback* cb = PopPendingCallback(sw)) {
+		/*if (!cb->isExecuting)*/ delete cb;
 	}
+
+	UnlinkReady(sw);
+}
+
+void CallbackHandler::UnparkCallbacks(SocketWrapper* sw) {
+	SetParked(sw, false);
+
+	if (sw->pendingCallbacksHead) LinkReady(sw);
 }
 
 void CallbackHandler::ExecuteQueuedCallbacks() {
-	Callback* cb = FetchFirstCallback();
-	if (!cb) return;
+	boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+	unsigned int executed = 0;
+
+	// drain the queue until it's empty or one of the limits is hit, always execute at least one callback
+	while (Callback* cb = FetchFirstCallback()) {
+//		cb->isExecuting = true;
+		cb->Execute();
+		delete cb;
+
+		executed++;
+
+		if (callbacksPerFrame && executed >= callbacksPerFrame) break;
+		if (callbackTimePerFrame && (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds() >= callbackTimePerFrame) break;
+	}
+}
 
-//	cb->isExecuting = true;
-	cb->Execute();
-	delete cb;
+bool CallbackHandler::SetOption(SM_SocketOption so, int value) {
+	switch (so) {
+		case SM_SO_CallbacksPerFrame:
+			if (value < 0) return false;
+			callbacksPerFrame = value;
+			return true;
+		case SM_SO_CallbackTimePerFrame:
+			if (value < 0) return false;
+			callbackTimePerFrame = value;
+			return true;
+		default:
+			return false;
+	}
 }
 
+bool CallbackHandler::SetOption(SocketWrapper* sw, SM_SocketOption so, int value) {
+	switch (so) {
+		case SM_SO_ConcatenateCallbacks:
+			if (value < 0) return false;
+			// chunks below 4096 bytes won't be concatenated any further
+			sw->concatenateCallbacks = (value > 0 && value < 4096) ? 4096 : value;
+			return true;
+		case SM_SO_CallbackPriority:
+			if (value < 1 || value > 100) return false;
+			sw->callbackPriority = value;
+			return true;
+		default:
+			return false;
+	}
+}
+
+/**
+ * deficit round robin across the sockets in the ready ring, weighted by the received bytes
+ *
+ * Each time a socket reaches the head of the ring it's granted CALLBACK_QUANTUM*priority bytes and
+ * keeps the head until its next callback costs more than its remaining deficit. Callbacks without
+ * data don't cost anything, so control events are never held back by other sockets' bulk data.
+ */
 Callback* CallbackHandler::FetchFirstCallback() {
-	boost::mutex::scoped_lock l(callbackQueueMutex);
+	FetchQueuedCallbacks();
+
+	SocketWrapper* sw;
+	Callback* ret;
+
+	for (;;) {
+		sw = readyHead;
+		if (!sw) return NULL;
+
+		ret = sw->pendingCallbacksHead;
+
+		if (!ret->IsExecutable()) {
+			// park the socket until the plugin sets the missing callback, see UnparkCallbacks()
+			UnlinkReady(sw);
+			SetParked(sw, true);
+			continue;
+		}
+
+		long cost = ret->GetDataLength();
+		if (cost <= sw->callbackDeficit) break;
+
+		if (!sw->callbackQuantumGranted) {
+			sw->callbackDeficit += CALLBACK_QUANTUM * sw->callbackPriority;
+			sw->callbackQuantumGranted = true;
+
+			if (cost <= sw->callbackDeficit) break;
+		}
+
+		// round is over for this socket, keep the deficit for the next one
+		sw->callbackQuantumGranted = false;
+		UnlinkReady(sw);
+		LinkReady(sw);
+	}
+
+	PopPendingCallback(sw);
+
+	if (ret->callbackEvent == CallbackEvent_Receive && sw->concatenateCallbacks) {
+		ConcatenateCallbacks(ret);
+	} else if (ret->callbackEvent == CallbackEvent_Incoming && sw->batchIncomingCallbacks) {
+		BatchIncomingCallbacks(ret);
+	}
+
+	sw->callbackDeficit -= ret->GetDataLength();
+
+	if (!sw->pendingCallbacksHead) UnlinkReady(sw);
+
+	return ret;
+}
+
+/**
+ * merge the following receive callbacks for the same socket into callback, stops at the first
+ * other event for the socket to preserve the order
+ */
+void CallbackHandler::ConcatenateCallbacks(Callback* callback) {
+	SocketWrapper* sw = callback->socketWrapper;
 
-	if (!callbackQueue.empty()) {
-		for (std::deque<Callback*>::iterator it=callbackQueue.begin(); it!=callbackQueue.end(); it++) {
-			Callback* ret = callbackQueue.front();
+	while (sw->pendingCallbacksHead &&
+		   sw->pendingCallbacksHead->callbackEvent == CallbackEvent_Receive &&
+		   callback->Concatenate(sw->pendingCallbacksHead, sw->concatenateCallbacks-1)) {
+		delete PopPendingCallback(sw);
+	}
+}
+
+/**
+ * chain the following incoming callbacks for the same socket to callback, stops at the first
+ * other event for the socket to preserve the order
+ */
+void CallbackHandler::BatchIncomingCallbacks(Callback* callback) {
+	SocketWrapper* sw = callback->socketWrapper;
+	Callback* last = callback;
 
-			if (!ret->IsExecutable()) {
-				std::cout << "[SERR] callback not executable (event=" << ret->callbackEvent << ")" << std::endl;
-				continue;
-			}
+	for (unsigned int i = 1; i < MAX_INCOMING_BATCH; i++) {
+		if (!sw->pendingCallbacksHead || sw->pendingCallbacksHead->callbackEvent != CallbackEvent_Incoming) break;
+
+		last->batchNext = PopPendingCallback(sw);
+		last = last->batchNext;
+	}
+}
 
-			callbackQueue.erase(it);
-			return ret;
+/**
+ * move the callbacks queued by the io thread(s) to the pending lists of their sockets
+ *
+ * @param marker	wait until this marker has been popped, producers may still be linking the
+ *					callbacks in front of it
+ */
+void CallbackHandler::FetchQueuedCallbacks(CallbackQueueNode* marker) {
+	for (;;) {
+		CallbackQueueNode* node = callbackQueue.Pop();
+
+		if (!node) {
+			if (!marker) return;
+
+			boost::this_thread::yield();
+			continue;
 		}
+
+		if (node == marker) return;
+
+		AppendPendingCallback(static_cast<Callback*>(node));
 	}
+}
 
-	return NULL;
+void CallbackHandler::AppendPendingCallback(Callback* callback) {
+	SocketWrapper* sw = callback->socketWrapper;
+
+	callback->pendingNext = NULL;
+
+	if (sw->pendingCallbacksTail) {
+		sw->pendingCallbacksTail->pendingNext = callback;
+	} else {
+		sw->pendingCallbacksHead = callback;
+		LinkReady(sw);
+	}
+
+	sw->pendingCallbacksTail = callback;
+}
+
+Callback* CallbackHandler::PopPendingCallback(SocketWrapper* sw) {
+	Callback* ret = sw->pendingCallbacksHead;
+	if (!ret) return NULL;
+
+	sw->pendingCallbacksHead = ret->pendingNext;
+	if (!sw->pendingCallbacksHead) sw->pendingCallbacksTail = NULL;
+
+	return ret;
+}
+
+/**
+ * tell the socket whether its callbacks are parked, it stops reading while they are so the parked
+ * data stays bounded, delivering the data resumes it
+ */
+void CallbackHandler::SetParked(SocketWrapper* sw, bool parked) {
+	switch (sw->socketType) {
+		case SM_SocketType_Tcp:
+			((Socket<tcp>*) sw->socket)->callbacksParked = parked;
+			break;
+		case SM_SocketType_Udp:
+			((Socket<udp>*) sw->socket)->callbacksParked = parked;
+			break;
+		default:
+			break;
+	}
+}
+
+void CallbackHandler::LinkReady(SocketWrapper* sw) {
+	if (sw->isReady) return;
+
+	sw->readyPrev = readyTail;
+	sw->readyNext = NULL;
+
+	if (readyTail) {
+		readyTail->readyNext = sw;
+	} else {
+		readyHead = sw;
+	}
+
+	readyTail = sw;
+	sw->isReady = true;
+}
+
+void CallbackHandler::UnlinkReady(SocketWrapper* sw) {
+	if (!sw->isReady) return;
+
+	if (sw->readyPrev) {
+		sw->readyPrev->readyNext = sw->readyNext;
+	} else {
+		readyHead = sw->readyNext;
+	}
+
+	if (sw->readyNext) {
+		sw->readyNext->readyPrev = sw->readyPrev;
+	} else {
+		readyTail = sw->readyPrev;
+	}
+
+	sw->readyPrev = NULL;
+	sw->readyNext = NULL;
+	sw->isReady = false;
+
+	if (!sw->pendingCallbacksHead) {
+		sw->callbackDeficit = 0;
+		sw->callbackQuantumGranted = false;
+	}
 }
 
 CallbackHandler callbackHandler;
@@ -1,8 +1,8 @@
 #ifndef INC_SEXT_CALLBACKHANDLER_H
 #define INC_SEXT_CALLBACKHANDLER_H
 
-#include <deque>
-#include <boost/thread.hpp>
+#include "CallbackQueue.h"
+#include "Define.h"
 
 class Callback;
 struct SocketWrapper;
@@ -10,19 +10,53 @@ struct SocketWrapper;
 /**
  * manages the callbacks for asynchronous operations.
  *
+ * AddCallback() is lock-free and may be called from any thread, all other methods must only be
+ * called from the game thread.
+ *
  * @note No destructor, objects will be freed by ~SocketHandler -> ~SocketWrapper -> CallbackHandler::RemoveCallbacks
  */
 class CallbackHandler {
 public:
+	CallbackHandler();
+
 	void AddCallback(Callback* callback);
 	void RemoveCallbacks(SocketWrapper* sw);
+	void UnparkCallbacks(SocketWrapper* sw);
 	void ExecuteQueuedCallbacks();
 
+	bool SetOption(SM_SocketOption so, int value);
+	bool SetOption(SocketWrapper* sw, SM_SocketOption so, int value);
+
 private:
 	Callback* FetchFirstCallback();
+	void FetchQueuedCallbacks(CallbackQueueNode* marker = NULL);
+	void ConcatenateCallbacks(Callback* callback);
+	void BatchIncomingCallbacks(Callback* callback);
+
+	void AppendPendingCallback(Callback* callback);
+	Callback* PopPendingCallback(SocketWrapper* sw);
+
+	void SetParked(SocketWrapper* sw, bool parked);
+	void LinkReady(SocketWrapper* sw);
+	void UnlinkReady(SocketWrapper* sw);
+
+	// filled by the io thread(s), drained by the game thread into the per socket pending lists
+	CallbackQueue<Callback> callbackQueue;
+
+	/**
+	 * ring of sockets with pending callbacks, served from the head
+	 *
+	 * Sockets whose first pending callback isn't executable yet are parked: they keep their pending
+	 * callbacks but are left out of the ring until UnparkCallbacks() is called for them.
+	 */
+	SocketWrapper* readyHead;
+	SocketWrapper* readyTail;
 
-	std::deque<Callback*> callbackQueue;
-	boost::mutex callbackQueueMutex;
+	/**
+	 * dispatch limits for a single ExecuteQueuedCallbacks() call, 0 disables the respective limit
+	 */
+	unsigned int callbacksPerFrame;
+	unsigned int callbackTimePerFrame; // in us
 };
 
 extern CallbackHandler callbackHandler;
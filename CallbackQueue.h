@@ -0,0 +1,82 @@
+#ifndef INC_SEXT_CALLBACKQUEUE_H
+#define INC_SEXT_CALLBACKQUEUE_H
+
+#include <boost/atomic.hpp>
+
+struct CallbackQueueNode {
+	CallbackQueueNode() : queueNext(NULL) {}
+
+	boost::atomic<CallbackQueueNode*> queueNext;
+};
+
+/**
+ * intrusive lock-free multi-producer/single-consumer queue (Vyukov)
+ *
+ * Push() may be called from any thread and never blocks, Pop() must only be called from the
+ * consumer thread (GameFrame).
+ */
+template <class T>
+class CallbackQueue {
+public:
+	CallbackQueue() : head(&stub), tail(&stub) {}
+
+	void Push(T* item) {
+		PushNode(item);
+	}
+
+	/**
+	 * push a node that isn't an item, Pop() returns it once everything pushed before it has been
+	 * popped, including items whose producers were still linking them
+	 */
+	void PushMarker(CallbackQueueNode* marker) {
+		PushNode(marker);
+	}
+
+	/**
+	 * @return the oldest item or marker, NULL if the queue is empty or a producer is in the middle
+	 *         of linking the next node (it'll be available in the next call)
+	 */
+	CallbackQueueNode* Pop() {
+		CallbackQueueNode* first = tail;
+		CallbackQueueNode* next = first->queueNext.load(boost::memory_order_acquire);
+
+		if (first == &stub) {
+			if (!next) return NULL;
+
+			tail = next;
+			first = next;
+			next = next->queueNext.load(boost::memory_order_acquire);
+		}
+
+		if (next) {
+			tail = next;
+			return first;
+		}
+
+		if (first != head.load(boost::memory_order_acquire)) return NULL;
+
+		PushNode(&stub);
+
+		next = first->queueNext.load(boost::memory_order_acquire);
+
+		if (next) {
+			tail = next;
+			return first;
+		}
+
+		return NULL;
+	}
+
+private:
+	void PushNode(CallbackQueueNode* node) {
+		node->queueNext.store(NULL, boost::memory_order_relaxed);
+		CallbackQueueNode* prev = head.exchange(node, boost::memory_order_acq_rel);
+		prev->queueNext.store(node, boost::memory_order_release);
+	}
+
+	boost::atomic<CallbackQueueNode*> head;
+	CallbackQueueNode* tail;
+	CallbackQueueNode stub;
+};
+
+#endif
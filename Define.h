@@ -9,6 +9,7 @@ enum SM_ErrorType {
 	SM_ErrorType_BIND_ERROR,
 	SM_ErrorType_RECV_ERROR,
 	SM_ErrorType_LISTEN_ERROR,
+	SM_ErrorType_TIMEOUT_ERROR,
 };
 
 enum SM_SocketType {
@@ -36,7 +37,66 @@ enum SM_SocketOption {
 	SM_SO_SocketSendLowWatermark,
 	SM_SO_SocketSendTimeout,
 	// ext options
-	SM_SO_DebugMode
+	SM_SO_DebugMode,
+	// SourceMod level options, continued
+	SM_SO_CallbackTimePerFrame,
+	SM_SO_CallbackPriority,
+	// ext level socket options
+	SM_SO_ReceiveQueueHighWatermark,
+	SM_SO_ReceiveQueueLowWatermark,
+	// ext options, continued
+	SM_SO_IoThreads,
+	// ext level socket options, continued
+	SM_SO_ListenShards,
+	SM_SO_ListenPendingAccepts,
+	SM_SO_ListenBacklog,
+	SM_SO_ReceiveChunkSize,
+	SM_SO_AdaptiveReceiveChunkSize,
+	SM_SO_ReceiveOnReadable,
+	SM_SO_SendQueueMaxBytes,
+	SM_SO_SendQueueOverflowPolicy,
+	SM_SO_SendQueueLowWatermark,
+	SM_SO_SendInline,
+	// ext options, continued
+	SM_SO_ResolverThreads,
+	SM_SO_ResolverCacheTtl,
+	SM_SO_ResolverNegativeCacheTtl,
+	// ext level socket options, continued
+	SM_SO_SocketConnectTimeout,
+	SM_SO_ListenMaxIdleTime,
+	SM_SO_ListenMaxConnections,
+};
+
+enum SM_SendQueueOverflow {
+	SM_SendQueueOverflow_Fail = 0,
+	SM_SendQueueOverflow_DropOldest,
+};
+
+enum SM_SocketStatistic {
+	// extension wide statistics
+	SM_SS_CallbackAllocations = 1,
+	SM_SS_CallbackHeapAllocations,
+	SM_SS_BufferAllocations,
+	SM_SS_BufferHeapAllocations,
+	SM_SS_HandlerLockAllocations,
+	SM_SS_HandlerLockHeapAllocations,
+	SM_SS_SocketCount,
+	SM_SS_ReceiveBufferBytes,
+	// socket statistics
+	SM_SS_CurrentReceiveChunkSize,
+	// extension wide statistics, continued
+	SM_SS_SendRequests,
+	SM_SS_SendOperations,
+	SM_SS_SendQueueDroppedBytes,
+	// socket statistics, continued
+	SM_SS_SendQueueBytes,
+	// extension wide statistics, continued
+	SM_SS_ResolverCacheHits,
+	SM_SS_ResolverCacheMisses,
+	// socket statistics, continued
+	SM_SS_ListenConnections,
+	SM_SS_ListenPeakConnections,
+	SM_SS_ListenReapedConnections,
 };
 
 struct SocketOption {
@@ -52,6 +112,9 @@ enum CallbackEvent {
 	CallbackEvent_Receive,
 	CallbackEvent_SendQueueEmpty,
 	CallbackEvent_Error,
+	CallbackEvent_SendQueueLow,
+	CallbackEvent_Bind,
+	CallbackEvent_AddressResolved,
 };
 
 #endif
@@ -5,7 +5,10 @@
 
 #include "CallbackHandler.h"
 #include "Callback.h"
+#include "Buffer.h"
+#include "ResolverCache.h"
 #include "Socket.h"
+#include "TimerWheel.h"
 
 using namespace boost::asio::ip;
 
@@ -23,6 +26,7 @@ bool Extension::SDK_OnLoad(char *error, size_t err_max, bool late) {
 
 	sharesys->AddNatives(myself, smsock_natives);
 	socketHandleType = handlesys->CreateType("Socket", this, 0, NULL, NULL, myself->GetIdentity(), NULL);
+	addressHandleType = handlesys->CreateType("SocketAddress", this, 0, NULL, NULL, myself->GetIdentity(), NULL);
 
 	//if (_debug) smutils->LogError(myself, "[Debug] Extension loaded");
 	socketHandler.StartProcessing();
@@ -33,13 +37,20 @@ bool Extension::SDK_OnLoad(char *error, size_t err_max, bool late) {
 void Extension::SDK_OnUnload() {
 	smutils->RemoveGameFrameHook(&GameFrame);
 	handlesys->RemoveType(socketHandleType, NULL);
+	handlesys->RemoveType(addressHandleType, NULL);
 
 	socketHandler.Shutdown();
+	resolverCache.Shutdown();
+	timerWheel.Shutdown();
 }
 
 void Extension::OnHandleDestroy(HandleType_t type, void *object) {
 	if (type == socketHandleType && object != NULL) {
 		socketHandler.DestroySocket((SocketWrapper*) object);
+	} else if (type == addressHandleType && object != NULL) {
+		Address* address = (Address*) object;
+		address->smHandle = 0;
+		address->Release();
 	}
 }
 
@@ -54,6 +65,17 @@ SocketWrapper* Extension::GetSocketWrapperByHandle(Handle_t handle) {
 	return sw;
 }
 
+Address* Extension::GetAddressByHandle(Handle_t handle) {
+	HandleSecurity sec;
+	sec.pOwner = NULL;
+	sec.pIdentity = myself->GetIdentity();
+	Address* address;
+
+	if (handlesys->ReadHandle(handle, addressHandleType, &sec, (void**)&address) != HandleError_None) return NULL;
+
+	return address;
+}
+
 
 // native bool:SocketIsConnected(Handle:socket);
 cell_t SocketIsConnected(IPluginContext *pContext, const cell_t *params) {
@@ -81,7 +103,7 @@ cell_t SocketCreate(IPluginContext *pContext, const cell_t *params) {
 	switch (params[1]) {
 		case SM_SocketType_Tcp: {
 			Socket<tcp>* socket = socketHandler.CreateSocket<tcp>(SM_SocketType_Tcp);
-			SocketWrapper* sw = socketHandler.GetSocketWrapper(socket);
+			SocketWrapper* sw = socketHandler.GetSocketWrapper(socket->socketId);
 
 			handle = handlesys->CreateHandle(extension.socketHandleType, sw, pContext->GetIdentity(), myself->GetIdentity(), NULL);
 
@@ -92,7 +114,7 @@ cell_t SocketCreate(IPluginContext *pContext, const cell_t *params) {
 		}
 		case SM_SocketType_Udp: {
 			Socket<udp>* socket = socketHandler.CreateSocket<udp>(SM_SocketType_Udp);
-			SocketWrapper* sw = socketHandler.GetSocketWrapper(socket);
+			SocketWrapper* sw = socketHandler.GetSocketWrapper(socket->socketId);
 
 			handle = handlesys->CreateHandle(extension.socketHandleType, sw, pContext->GetIdentity(), myself->GetIdentity(), NULL);
 
@@ -125,6 +147,33 @@ cell_t SocketBind(IPluginContext *pContext, const cell_t *params) {
 	}
 }
 
+// native SocketBindAsync(Handle:socket, SocketBindCB:bfunc, String:hostname[], port);
+cell_t SocketBindAsync(IPluginContext *pContext, const cell_t *params) {
+	SocketWrapper* sw = extension.GetSocketWrapperByHandle(static_cast<Handle_t>(params[1]));
+	if (sw == NULL) return pContext->ThrowNativeError("Invalid handle: %i", params[1]);
+	if (params[4] < 0 || params[4] > 65535) return pContext->ThrowNativeError("Invalid port specified");
+
+	char *hostname = NULL;
+	pContext->LocalToString(params[3], &hostname);
+
+	switch (sw->socketType) {
+		case SM_SocketType_Tcp: {
+			Socket<tcp>* socket = (Socket<tcp>*) sw->socket;
+			socket->bindCallback = pContext->GetFunctionById(params[2]);
+			callbackHandler.UnparkCallbacks(sw);
+			return socket->Bind(hostname, params[4]);
+		}
+		case SM_SocketType_Udp: {
+			Socket<udp>* socket = (Socket<udp>*) sw->socket;
+			socket->bindCallback = pContext->GetFunctionById(params[2]);
+			callbackHandler.UnparkCallbacks(sw);
+			return socket->Bind(hostname, params[4]);
+		}
+		default:
+			return false;
+	}
+}
+
 // native SocketConnect(Handle:socket, SocketConnectCB:cfunc, SocketReceiveCB:rfunc, SocketDisconnectCB:dfunc, String:hostname[], port);
 cell_t SocketConnect(IPluginContext *pContext, const cell_t *params) {
 	SocketWrapper* sw = extension.GetSocketWrapperByHandle(static_cast<Handle_t>(params[1]));
@@ -146,6 +195,7 @@ cell_t SocketConnect(IPluginContext *pContext, const cell_t *params) {
 			socket->connectCallback = pContext->GetFunctionById(params[2]);
 			socket->receiveCallback = pContext->GetFunctionById(params[3]);
 			socket->disconnectCallback = pContext->GetFunctionById(params[4]);
+			callbackHandler.UnparkCallbacks(sw);
 
 			return socket->Connect(hostname, params[6]);
 		}
@@ -156,6 +206,7 @@ cell_t SocketConnect(IPluginContext *pContext, const cell_t *params) {
 			socket->connectCallback = pContext->GetFunctionById(params[2]);
 			socket->receiveCallback = pContext->GetFunctionById(params[3]);
 			socket->disconnectCallback = pContext->GetFunctionById(params[4]);
+			callbackHandler.UnparkCallbacks(sw);
 
 			return socket->Connect(hostname, params[6]);
 		}
@@ -197,12 +248,14 @@ cell_t SocketListen(IPluginContext *pContext, const cell_t *params) {
 			Socket<tcp>* socket = (Socket<tcp>*) sw->socket;
 			if (socket->IsOpen()) return pContext->ThrowNativeError("Socket is already open");
 			socket->incomingCallback = pContext->GetFunctionById(params[2]);
+			callbackHandler.UnparkCallbacks(sw);
 			return socket->Listen();
 		}
 		case SM_SocketType_Udp: {
 			Socket<udp>* socket = (Socket<udp>*) sw->socket;
 			if (socket->IsOpen()) return pContext->ThrowNativeError("Socket is already open");
 			socket->incomingCallback = pContext->GetFunctionById(params[2]);
+			callbackHandler.UnparkCallbacks(sw);
 			return socket->Listen();
 		}
 		default:
@@ -210,33 +263,38 @@ cell_t SocketListen(IPluginContext *pContext, const cell_t *params) {
 	}
 }
 
+/**
+ * @return whether length bytes starting at the local address data lie within the plugin's memory
+ */
+static bool IsValidDataLength(IPluginContext *pContext, cell_t data, size_t length) {
+	cell_t* last;
+
+	return length == 0 || pContext->LocalToPhysAddr((cell_t) ((ucell_t) data + length - 1), &last) == SP_ERROR_NONE;
+}
+
 // native SocketSend(Handle:socket, String:command[], size);
 cell_t SocketSend(IPluginContext *pContext, const cell_t *params) {
 	SocketWrapper* sw = extension.GetSocketWrapperByHandle(static_cast<Handle_t>(params[1]));
 	if (sw == NULL) return pContext->ThrowNativeError("Invalid handle: %i", params[1]);
+	if (params[3] < -1) return pContext->ThrowNativeError("Invalid size specified");
 
 	char* dataTmp = NULL;
 	pContext->LocalToString(params[2], &dataTmp);
 
-	std::string data;
-
-	if (params[3] == -1) {
-		data.assign(dataTmp);
-	} else {
-		data.assign(dataTmp, params[3]);
-	}
+	size_t length = (params[3] == -1) ? strlen(dataTmp) : params[3];
+	if (!IsValidDataLength(pContext, params[2], length)) return pContext->ThrowNativeError("Size exceeds the data array");
 
 	switch (sw->socketType) {
 		case SM_SocketType_Tcp: {
 			Socket<tcp>* socket = (Socket<tcp>*) sw->socket;
 			if (!socket->IsOpen()) return pContext->ThrowNativeError("Can't send, socket is not connected");
-			return socket->Send(data);
+			return socket->Send(Buffer::Create(dataTmp, length));
 		}
 		case SM_SocketType_Udp: {
 			Socket<udp>* socket = (Socket<udp>*) sw->socket;
 			if (!socket->IsOpen()) return pContext->ThrowNativeError("Can't send, socket is not connected");
 			socket->incomingCallback = pContext->GetFunctionById(params[2]);
-			return socket->Send(data);
+			return socket->Send(Buffer::Create(dataTmp, length));
 		}
 		default:
 			return false;
@@ -248,6 +306,7 @@ cell_t SocketSendTo(IPluginContext *pContext, const cell_t *params) {
 	SocketWrapper* sw = extension.GetSocketWrapperByHandle(static_cast<Handle_t>(params[1]));
 	if (sw == NULL) return pContext->ThrowNativeError("Invalid handle: %i", params[1]);
 	if (sw->socketType == SM_SocketType_Tcp) return pContext->ThrowNativeError("This native doesn't support connection orientated protocols");
+	if (params[3] < -1) return pContext->ThrowNativeError("Invalid size specified");
 
 	char* dataTmp = NULL;
 	pContext->LocalToString(params[2], &dataTmp);
@@ -257,6 +316,7 @@ cell_t SocketSendTo(IPluginContext *pContext, const cell_t *params) {
 	if (params[3] == -1) {
 		data.assign(dataTmp);
 	} else {
+		if (!IsValidDataLength(pContext, params[2], params[3])) return pContext->ThrowNativeError("Size exceeds the data array");
 		data.assign(dataTmp, params[3]);
 	}
 
@@ -275,13 +335,79 @@ cell_t SocketSendTo(IPluginContext *pContext, const cell_t *params) {
 	}
 }
 
+// native Handle:SocketCreateAddress(Handle:socket, SocketAddressCB:afunc, const String:hostname[], port);
+cell_t SocketCreateAddress(IPluginContext *pContext, const cell_t *params) {
+	SocketWrapper* sw = extension.GetSocketWrapperByHandle(static_cast<Handle_t>(params[1]));
+	if (sw == NULL) return pContext->ThrowNativeError("Invalid handle: %i", params[1]);
+	if (params[4] < 0 || params[4] > 65535) return pContext->ThrowNativeError("Invalid port specified");
+
+	char* hostname = NULL;
+	pContext->LocalToString(params[3], &hostname);
+
+	Address* address = Address::Create(hostname, params[4]);
+	cell_t handle = handlesys->CreateHandle(extension.addressHandleType, address, pContext->GetIdentity(), myself->GetIdentity(), NULL);
+
+	if (!handle) {
+		address->Release();
+		return handle;
+	}
+
+	address->smHandle = handle;
+
+	switch (sw->socketType) {
+		case SM_SocketType_Tcp: {
+			Socket<tcp>* socket = (Socket<tcp>*) sw->socket;
+			address->Resolve(socket->socketId, socket->CreateHandlerLock(), pContext->GetFunctionById(params[2]), socket->smCallbackArg);
+			break;
+		}
+		case SM_SocketType_Udp: {
+			Socket<udp>* socket = (Socket<udp>*) sw->socket;
+			address->Resolve(socket->socketId, socket->CreateHandlerLock(), pContext->GetFunctionById(params[2]), socket->smCallbackArg);
+			break;
+		}
+	}
+
+	return handle;
+}
+
+// native bool:SocketSendToAddress(Handle:socket, const String:data[], size=-1, Handle:address);
+cell_t SocketSendToAddress(IPluginContext *pContext, const cell_t *params) {
+	SocketWrapper* sw = extension.GetSocketWrapperByHandle(static_cast<Handle_t>(params[1]));
+	if (sw == NULL) return pContext->ThrowNativeError("Invalid handle: %i", params[1]);
+	if (sw->socketType == SM_SocketType_Tcp) return pContext->ThrowNativeError("This native doesn't support connection orientated protocols");
+
+	Address* address = extension.GetAddressByHandle(static_cast<Handle_t>(params[4]));
+	if (address == NULL) return pContext->ThrowNativeError("Invalid address handle: %i", params[4]);
+	if (!address->IsResolved()) return false;
+	if (params[3] < -1) return pContext->ThrowNativeError("Invalid size specified");
+
+	char* dataTmp = NULL;
+	pContext->LocalToString(params[2], &dataTmp);
+
+	size_t length = (params[3] == -1) ? strlen(dataTmp) : params[3];
+	if (!IsValidDataLength(pContext, params[2], length)) return pContext->ThrowNativeError("Size exceeds the data array");
+
+	switch (sw->socketType) {
+		case SM_SocketType_Udp:
+			return ((Socket<udp>*) sw->socket)->SendTo(Buffer::Create(dataTmp, length), address->GetEndpoint());
+		default:
+			return false;
+	}
+}
+
 // native SocketSetOption(Handle:socket, SocketOption:option, value)
 cell_t SocketSetOption(IPluginContext *pContext, const cell_t *params) {
 	SocketWrapper* sw = extension.GetSocketWrapperByHandle(static_cast<Handle_t>(params[1]));
 	if (params[2] != SM_SO_ConcatenateCallbacks &&
 		params[2] != SM_SO_ForceFrameLock &&
 		params[2] != SM_SO_CallbacksPerFrame &&
-		params[2] != SM_SO_DebugMode) {
+		params[2] != SM_SO_DebugMode &&
+		params[2] != SM_SO_CallbackTimePerFrame &&
+		params[2] != SM_SO_CallbackPriority &&
+		params[2] != SM_SO_IoThreads &&
+		params[2] != SM_SO_ResolverThreads &&
+		params[2] != SM_SO_ResolverCacheTtl &&
+		params[2] != SM_SO_ResolverNegativeCacheTtl) {
 		if (sw == NULL) return pContext->ThrowNativeError("Invalid handle: %i", params[1]);
 
 		switch (sw->socketType) {
@@ -295,7 +421,23 @@ cell_t SocketSetOption(IPluginContext *pContext, const cell_t *params) {
 				return false;
 		}
 	} else {
-		return false;
+		switch (params[2]) {
+			case SM_SO_ConcatenateCallbacks:
+			case SM_SO_CallbackPriority:
+				if (sw == NULL) return pContext->ThrowNativeError("Invalid handle: %i", params[1]);
+				return callbackHandler.SetOption(sw, (SM_SocketOption) params[2], params[3]);
+			case SM_SO_CallbacksPerFrame:
+			case SM_SO_CallbackTimePerFrame:
+				return callbackHandler.SetOption((SM_SocketOption) params[2], params[3]);
+			case SM_SO_IoThreads:
+				return socketHandler.SetOption((SM_SocketOption) params[2], params[3]);
+			case SM_SO_ResolverThreads:
+			case SM_SO_ResolverCacheTtl:
+			case SM_SO_ResolverNegativeCacheTtl:
+				return resolverCache.SetOption((SM_SocketOption) params[2], params[3]);
+			default:
+				return false;
+		}
 	}
 
 #if 0
@@ -321,6 +463,81 @@ cell_t SocketSetOption(IPluginContext *pContext, const cell_t *params) {
 #endif
 }
 
+// native SocketGetStatistic(Handle:socket, SocketStatistic:stat)
+cell_t SocketGetStatistic(IPluginContext *pContext, const cell_t *params) {
+	switch (params[2]) {
+		case SM_SS_CallbackAllocations:
+			return Callback::pool.GetAllocations();
+		case SM_SS_CallbackHeapAllocations:
+			return Callback::pool.GetHeapAllocations();
+		case SM_SS_BufferAllocations:
+			return Buffer::GetAllocations();
+		case SM_SS_BufferHeapAllocations:
+			return Buffer::GetHeapAllocations();
+		case SM_SS_HandlerLockAllocations:
+			return HandlerLock::pool.GetAllocations();
+		case SM_SS_HandlerLockHeapAllocations:
+			return HandlerLock::pool.GetHeapAllocations();
+		case SM_SS_SocketCount:
+			return socketHandler.GetSocketCount();
+		case SM_SS_ReceiveBufferBytes:
+			return socketHandler.receiveBufferBytes;
+		case SM_SS_SendRequests:
+			return socketHandler.sendRequests;
+		case SM_SS_SendOperations:
+			return socketHandler.sendOperations;
+		case SM_SS_SendQueueDroppedBytes:
+			return socketHandler.sendQueueDroppedBytes;
+		case SM_SS_ResolverCacheHits:
+			return resolverCache.cacheHits;
+		case SM_SS_ResolverCacheMisses:
+			return resolverCache.cacheMisses;
+		case SM_SS_CurrentReceiveChunkSize: {
+			SocketWrapper* sw = extension.GetSocketWrapperByHandle(static_cast<Handle_t>(params[1]));
+			if (sw == NULL) return pContext->ThrowNativeError("Invalid handle: %i", params[1]);
+
+			switch (sw->socketType) {
+				case SM_SocketType_Tcp:
+					return ((Socket<tcp>*) sw->socket)->GetReceiveChunkSize();
+				case SM_SocketType_Udp:
+					return ((Socket<udp>*) sw->socket)->GetReceiveChunkSize();
+				default:
+					return false;
+			}
+		}
+		case SM_SS_SendQueueBytes: {
+			SocketWrapper* sw = extension.GetSocketWrapperByHandle(static_cast<Handle_t>(params[1]));
+			if (sw == NULL) return pContext->ThrowNativeError("Invalid handle: %i", params[1]);
+
+			switch (sw->socketType) {
+				case SM_SocketType_Tcp:
+					return ((Socket<tcp>*) sw->socket)->sendQueueBytes;
+				case SM_SocketType_Udp:
+					return ((Socket<udp>*) sw->socket)->sendQueueBytes;
+				default:
+					return false;
+			}
+		}
+		case SM_SS_ListenConnections:
+		case SM_SS_ListenPeakConnections:
+		case SM_SS_ListenReapedConnections: {
+			SocketWrapper* sw = extension.GetSocketWrapperByHandle(static_cast<Handle_t>(params[1]));
+			if (sw == NULL) return pContext->ThrowNativeError("Invalid handle: %i", params[1]);
+
+			switch (sw->socketType) {
+				case SM_SocketType_Tcp:
+					return ((Socket<tcp>*) sw->socket)->GetListenStatistic((SM_SocketStatistic) params[2]);
+				case SM_SocketType_Udp:
+					return ((Socket<udp>*) sw->socket)->GetListenStatistic((SM_SocketStatistic) params[2]);
+				default:
+					return false;
+			}
+		}
+		default:
+			return pContext->ThrowNativeError("Invalid statistic specified");
+	}
+}
+
 
 // native SocketSetReceiveCallback(Handle:socket, SocketReceiveCB:rfunc);
 cell_t SocketSetReceiveCallback(IPluginContext *pContext, const cell_t *params) {
@@ -333,10 +550,28 @@ cell_t SocketSetReceiveCallback(IPluginContext *pContext, const cell_t *params)
 			break;
 		case SM_SocketType_Udp:
 			((Socket<udp>*) sw->socket)->receiveCallback = pContext->GetFunctionById((params[2]));
+			break;
 		default:
 			return false;
 	}
 
+	callbackHandler.UnparkCallbacks(sw);
+
+	return true;
+}
+
+// native SocketSetIncomingBatchCallback(Handle:socket, SocketIncomingBatchCB:ifunc);
+cell_t SocketSetIncomingBatchCallback(IPluginContext *pContext, const cell_t *params) {
+	SocketWrapper* sw = extension.GetSocketWrapperByHandle(static_cast<Handle_t>(params[1]));
+	if (sw == NULL) return pContext->ThrowNativeError("Invalid handle: %i", params[1]);
+	if (sw->socketType != SM_SocketType_Tcp) return pContext->ThrowNativeError("The socket must use the TCP/SOCK_STREAM protocol");
+
+	Socket<tcp>* socket = (Socket<tcp>*) sw->socket;
+	socket->incomingBatchCallback = pContext->GetFunctionById((params[2]));
+	sw->batchIncomingCallbacks = (socket->incomingBatchCallback != NULL);
+
+	callbackHandler.UnparkCallbacks(sw);
+
 	return true;
 }
 
@@ -354,15 +589,39 @@ cell_t SocketSetSendqueueEmptyCallback(IPluginContext *pContext, const cell_t *p
 			break;
 		case SM_SocketType_Udp:
 			((Socket<udp>*) sw->socket)->sendqueueEmptyCallback = pContext->GetFunctionById((params[2]));
-			if (!((Socket<tcp>*) sw->socket)->sendQueueLength) forceSendqueueEmptyCallback = true;
+			if (!((Socket<udp>*) sw->socket)->sendQueueLength) forceSendqueueEmptyCallback = true;
+			break;
 		default:
 			return false;
 	}
 
 	if (forceSendqueueEmptyCallback) {
-		callbackHandler.AddCallback(new Callback(CallbackEvent_SendQueueEmpty, sw->socket));
+		callbackHandler.AddCallback(new Callback(CallbackEvent_SendQueueEmpty, sw->id));
+	}
+
+	callbackHandler.UnparkCallbacks(sw);
+
+	return true;
+}
+
+// native SocketSetSendqueueLowCallback(Handle:socket, SocketSendqueueLowCB:lfunc);
+cell_t SocketSetSendqueueLowCallback(IPluginContext *pContext, const cell_t *params) {
+	SocketWrapper* sw = extension.GetSocketWrapperByHandle(static_cast<Handle_t>(params[1]));
+	if (sw == NULL) return pContext->ThrowNativeError("Invalid handle: %i", params[1]);
+
+	switch (sw->socketType) {
+		case SM_SocketType_Tcp:
+			((Socket<tcp>*) sw->socket)->sendqueueLowCallback = pContext->GetFunctionById((params[2]));
+			break;
+		case SM_SocketType_Udp:
+			((Socket<udp>*) sw->socket)->sendqueueLowCallback = pContext->GetFunctionById((params[2]));
+			break;
+		default:
+			return false;
 	}
 
+	callbackHandler.UnparkCallbacks(sw);
+
 	return true;
 }
 
@@ -377,10 +636,13 @@ cell_t SocketSetDisconnectCallback(IPluginContext *pContext, const cell_t *param
 			break;
 		case SM_SocketType_Udp:
 			((Socket<udp>*) sw->socket)->disconnectCallback = pContext->GetFunctionById((params[2]));
+			break;
 		default:
 			return false;
 	}
 
+	callbackHandler.UnparkCallbacks(sw);
+
 	return true;
 }
 
@@ -395,10 +657,13 @@ cell_t SocketSetErrorCallback(IPluginContext *pContext, const cell_t *params) {
 			break;
 		case SM_SocketType_Udp:
 			((Socket<udp>*) sw->socket)->errorCallback = pContext->GetFunctionById((params[2]));
+			break;
 		default:
 			return false;
 	}
 
+	callbackHandler.UnparkCallbacks(sw);
+
 	return true;
 }
 
@@ -414,6 +679,7 @@ cell_t SocketSetArg(IPluginContext *pContext, const cell_t *params) {
 			break;
 		case SM_SocketType_Udp:
 			((Socket<udp>*) sw->socket)->smCallbackArg = params[2];
+			break;
 		default:
 			return false;
 	}
@@ -444,15 +710,21 @@ const sp_nativeinfo_t smsock_natives[] = {
 
 	{"SocketCreate",			SocketCreate},
 	{"SocketBind",				SocketBind},
+	{"SocketBindAsync",			SocketBindAsync},
 	{"SocketConnect",			SocketConnect},
 	{"SocketDisconnect",		SocketDisconnect},
 	{"SocketListen",			SocketListen},
 	{"SocketSend",				SocketSend},
 	{"SocketSendTo",			SocketSendTo},
+	{"SocketSendToAddress",		SocketSendToAddress},
+	{"SocketCreateAddress",		SocketCreateAddress},
 	{"SocketSetOption",			SocketSetOption},
+	{"SocketGetStatistic",		SocketGetStatistic},
 
 	{"SocketSetReceiveCallback",		SocketSetReceiveCallback},
+	{"SocketSetIncomingBatchCallback",	SocketSetIncomingBatchCallback},
 	{"SocketSetSendqueueEmptyCallback",	SocketSetSendqueueEmptyCallback},
+	{"SocketSetSendqueueLowCallback",	SocketSetSendqueueLowCallback},
 	{"SocketSetDisconnectCallback",		SocketSetDisconnectCallback},
 	{"SocketSetErrorCallback",			SocketSetErrorCallback},
 
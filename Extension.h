@@ -2,6 +2,7 @@
 #define INC_SEXT_EXTENSION_H
 
 #include "sdk/smsdk_ext.h"
+#include "Address.h"
 #include "SocketHandler.h"
 
 class Extension : public SDKExtension, public IHandleTypeDispatch {
@@ -11,8 +12,10 @@ public:
 	void OnHandleDestroy(HandleType_t type, void *object);
 
 	SocketWrapper* GetSocketWrapperByHandle(Handle_t);
+	Address* GetAddressByHandle(Handle_t);
 
 	HandleType_t socketHandleType;
+	HandleType_t addressHandleType;
 };
 
 extern Extension extension;
@@ -0,0 +1,61 @@
+#ifndef INC_SEXT_POOL_H
+#define INC_SEXT_POOL_H
+
+#include <stdint.h>
+#include <new>
+#include <boost/atomic.hpp>
+#include <boost/lockfree/stack.hpp>
+
+/**
+ * allocation counters shared by the pools
+ */
+class PoolStatistics {
+public:
+	PoolStatistics() : allocations(0), heapAllocations(0) {}
+
+	uint32_t GetAllocations() const { return allocations; }
+	uint32_t GetHeapAllocations() const { return heapAllocations; }
+
+protected:
+	boost::atomic<uint32_t> allocations;
+	boost::atomic<uint32_t> heapAllocations;
+};
+
+/**
+ * lock-free free list for blocks of a fixed size, may be used from any thread
+ *
+ * Blocks are taken from the heap if the free list is empty and returned to it if the free list is
+ * full.
+ */
+class MemoryPool : public PoolStatistics {
+public:
+	MemoryPool(size_t blockSize, size_t capacity) : blockSize(blockSize), freeList(capacity) {}
+
+	~MemoryPool() {
+		void* block;
+		while (freeList.pop(block)) ::operator delete(block);
+	}
+
+	void* Allocate(size_t size) {
+		if (size > blockSize) return ::operator new(size);
+
+		allocations++;
+
+		void* ret;
+		if (freeList.pop(ret)) return ret;
+
+		heapAllocations++;
+		return ::operator new(blockSize);
+	}
+
+	void Free(void* block, size_t size) {
+		if (!block) return;
+		if (size > blockSize || !freeList.bounded_push(block)) ::operator delete(block);
+	}
+
+private:
+	const size_t blockSize;
+	boost::lockfree::stack<void*> freeList;
+};
+
+#endif
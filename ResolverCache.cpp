@@ -0,0 +1,301 @@
+#include "ResolverCache.h"
+
+#include <boost/bind.hpp>
+
+#include "SocketHandler.h"
+
+using namespace boost::asio::ip;
+
+// seconds to keep successful and failed lookups
+#define RESOLVER_CACHE_TTL 300
+#define RESOLVER_NEGATIVE_CACHE_TTL 30
+
+#define RESOLVER_THREADS 2
+#define MAX_RESOLVER_THREADS 16
+
+// expired entries are dropped once the cache reached this size, further ones in hostname order after them
+#define MAX_RESOLVER_CACHE_ENTRIES 1024
+
+ResolverCache::ResolverCache() : cacheHits(0),
+								 cacheMisses(0),
+								 cacheTtl(RESOLVER_CACHE_TTL),
+								 negativeCacheTtl(RESOLVER_NEGATIVE_CACHE_TTL),
+								 resolveService(NULL),
+								 resolveWork(NULL),
+								 resolveThreadCount(RESOLVER_THREADS) {
+}
+
+ResolverCache::~ResolverCache() {
+	Shutdown();
+}
+
+void ResolverCache::AsyncResolve(const char* hostname, const Handler& handler) {
+	ResolvedAddresses addresses;
+
+	if (ParseNumeric(hostname, addresses)) {
+		handler(boost::system::error_code(), addresses);
+		return;
+	}
+
+	std::string key(hostname);
+	boost::system::error_code errorCode;
+	bool query = false;
+
+	{ // lock
+		boost::mutex::scoped_lock l(cacheMutex);
+
+		boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+		std::map<std::string, Entry>::iterator it = cache.find(key);
+
+		if (it != cache.end() && (it->second.pending || it->second.expiry > now)) {
+			cacheHits++;
+
+			// join the running query
+			if (it->second.pending) {
+				it->second.waiters.push_back(handler);
+				return;
+			}
+
+			errorCode = it->second.errorCode;
+			addresses = it->second.addresses;
+		} else {
+			cacheMisses++;
+
+			if (it == cache.end()) {
+				MakeRoom(now);
+				it = cache.insert(std::make_pair(key, Entry())).first;
+			}
+
+			it->second.pending = true;
+			it->second.waiters.push_back(handler);
+			query = true;
+		}
+	} // ~lock
+
+	if (query) {
+		StartThreads();
+		resolveService->post(boost::bind(&ResolverCache::QueryHandler, this, key));
+		return;
+	}
+
+	handler(errorCode, addresses);
+}
+
+boost::system::error_code ResolverCache::Resolve(const char* hostname, ResolvedAddresses& addresses) {
+	if (ParseNumeric(hostname, addresses)) return boost::system::error_code();
+
+	std::string key(hostname);
+
+	{ // lock
+		boost::mutex::scoped_lock l(cacheMutex);
+
+		std::map<std::string, Entry>::iterator it = cache.find(key);
+
+		if (it != cache.end() && !it->second.pending && it->second.expiry > boost::posix_time::microsec_clock::universal_time()) {
+			cacheHits++;
+			addresses = it->second.addresses;
+			return it->second.errorCode;
+		}
+	} // ~lock
+
+	cacheMisses++;
+
+	boost::system::error_code errorCode = Query(key, addresses);
+	Store(key, errorCode, addresses, NULL);
+
+	return errorCode;
+}
+
+void ResolverCache::Shutdown() {
+	{ // lock
+		boost::mutex::scoped_lock l(resolveThreadsMutex);
+
+		if (!resolveService) return;
+
+		// let the queued lookups finish, their handlers hold locks of the sockets waiting for them
+		delete resolveWork;
+		resolveWork = NULL;
+
+		for (std::vector<boost::thread*>::iterator it=resolveThreads.begin(); it!=resolveThreads.end(); it++) {
+			(*it)->join();
+			delete *it;
+		}
+
+		resolveThreads.clear();
+
+		delete resolveService;
+		resolveService = NULL;
+	} // ~lock
+
+	boost::mutex::scoped_lock l(cacheMutex);
+	cache.clear();
+}
+
+bool ResolverCache::SetOption(SM_SocketOption so, int value) {
+	switch (so) {
+		case SM_SO_ResolverThreads: {
+			boost::mutex::scoped_lock l(resolveThreadsMutex);
+
+			if (value < 1 || value > MAX_RESOLVER_THREADS || (unsigned int) value < resolveThreads.size()) return false;
+
+			resolveThreadCount = value;
+
+			if (resolveService) {
+				while (resolveThreads.size() < resolveThreadCount) {
+					resolveThreads.push_back(new boost::thread(boost::bind(&ResolverCache::RunResolveService, this)));
+				}
+			}
+
+			return true;
+		}
+		case SM_SO_ResolverCacheTtl: {
+			if (value < 0) return false;
+
+			boost::mutex::scoped_lock l(cacheMutex);
+			cacheTtl = value;
+
+			return true;
+		}
+		case SM_SO_ResolverNegativeCacheTtl: {
+			if (value < 0) return false;
+
+			boost::mutex::scoped_lock l(cacheMutex);
+			negativeCacheTtl = value;
+
+			return true;
+		}
+		default:
+			return false;
+	}
+}
+
+/**
+ * numeric addresses are never looked up or cached
+ */
+bool ResolverCache::ParseNumeric(const char* hostname, ResolvedAddresses& addresses) {
+	boost::system::error_code errorCode;
+	address numericAddress = address::from_string(hostname, errorCode);
+
+	if (errorCode) return false;
+
+	addresses.reset(new AddressList(1, numericAddress));
+
+	return true;
+}
+
+/**
+ * blocking lookup of both address families in the resolver's preference order, runs on a
+ * resolver thread or the thread calling Resolve()
+ */
+boost::system::error_code ResolverCache::Query(const std::string& hostname, ResolvedAddresses& addresses) {
+	boost::system::error_code errorCode;
+
+	tcp::resolver resolver(*socketHandler.ioService);
+	tcp::resolver::iterator endpointIterator = resolver.resolve(tcp::resolver::query(hostname, "0"), errorCode);
+
+	if (errorCode) return errorCode;
+
+	AddressList* addressList = new AddressList();
+
+	for (tcp::resolver::iterator end; endpointIterator != end; endpointIterator++) {
+		addressList->push_back(endpointIterator->endpoint().address());
+	}
+
+	addresses.reset(addressList);
+
+	if (addressList->empty()) errorCode = boost::asio::error::host_not_found;
+
+	return errorCode;
+}
+
+/**
+ * cache the result of a query, waiters receives the handlers waiting for it if the query was
+ * started by AsyncResolve()
+ */
+void ResolverCache::Store(const std::string& hostname, const boost::system::error_code& errorCode, ResolvedAddresses addresses, std::vector<Handler>* waiters) {
+	boost::mutex::scoped_lock l(cacheMutex);
+
+	boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+	std::map<std::string, Entry>::iterator it = cache.find(hostname);
+
+	if (it == cache.end()) {
+		MakeRoom(now);
+		it = cache.insert(std::make_pair(hostname, Entry())).first;
+	} else if (it->second.pending && !waiters) {
+		// the running query stores its own result
+		return;
+	}
+
+	if (waiters) {
+		waiters->swap(it->second.waiters);
+		it->second.pending = false;
+	}
+
+	int ttl = errorCode ? negativeCacheTtl : cacheTtl;
+
+	if (ttl == 0) {
+		cache.erase(it);
+		return;
+	}
+
+	it->second.errorCode = errorCode;
+	it->second.addresses = addresses;
+	it->second.expiry = now + boost::posix_time::seconds(ttl);
+}
+
+/**
+ * keep the cache below MAX_RESOLVER_CACHE_ENTRIES, cacheMutex has to be locked
+ */
+void ResolverCache::MakeRoom(const boost::posix_time::ptime& now) {
+	if (cache.size() < MAX_RESOLVER_CACHE_ENTRIES) return;
+
+	for (std::map<std::string, Entry>::iterator it=cache.begin(); it!=cache.end();) {
+		if (!it->second.pending && it->second.expiry <= now) {
+			cache.erase(it++);
+		} else {
+			it++;
+		}
+	}
+
+	for (std::map<std::string, Entry>::iterator it=cache.begin(); it!=cache.end() && cache.size() >= MAX_RESOLVER_CACHE_ENTRIES;) {
+		if (!it->second.pending) {
+			cache.erase(it++);
+		} else {
+			it++;
+		}
+	}
+}
+
+void ResolverCache::QueryHandler(std::string hostname) {
+	ResolvedAddresses addresses;
+	boost::system::error_code errorCode = Query(hostname, addresses);
+
+	std::vector<Handler> waiters;
+	Store(hostname, errorCode, addresses, &waiters);
+
+	for (std::vector<Handler>::iterator it=waiters.begin(); it!=waiters.end(); it++) {
+		(*it)(errorCode, addresses);
+	}
+}
+
+/**
+ * start the resolver threads on the first lookup
+ */
+void ResolverCache::StartThreads() {
+	boost::mutex::scoped_lock l(resolveThreadsMutex);
+
+	if (!resolveService) {
+		resolveService = new boost::asio::io_service();
+		resolveWork = new boost::asio::io_service::work(*resolveService);
+	}
+
+	while (resolveThreads.size() < resolveThreadCount) {
+		resolveThreads.push_back(new boost::thread(boost::bind(&ResolverCache::RunResolveService, this)));
+	}
+}
+
+void ResolverCache::RunResolveService() {
+	resolveService->run();
+}
+
+ResolverCache resolverCache;
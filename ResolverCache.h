@@ -0,0 +1,91 @@
+#ifndef INC_SEXT_RESOLVERCACHE_H
+#define INC_SEXT_RESOLVERCACHE_H
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/atomic.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include "Define.h"
+
+typedef std::vector<boost::asio::ip::address> AddressList;
+typedef boost::shared_ptr<const AddressList> ResolvedAddresses;
+
+/**
+ * extension wide hostname lookup cache
+ *
+ * Lookups run on a bounded pool of resolver threads, concurrent lookups of the same hostname
+ * share a single request. Results are kept for cacheTtl seconds, failures for negativeCacheTtl
+ * seconds.
+ */
+class ResolverCache {
+public:
+	typedef boost::function<void (const boost::system::error_code&, ResolvedAddresses)> Handler;
+
+	ResolverCache();
+	~ResolverCache();
+
+	/**
+	 * look up hostname, handler is called right away for numeric addresses and cached results,
+	 * from a resolver thread otherwise
+	 */
+	void AsyncResolve(const char* hostname, const Handler& handler);
+
+	/**
+	 * look up hostname on the calling thread unless the result is cached
+	 */
+	boost::system::error_code Resolve(const char* hostname, ResolvedAddresses& addresses);
+
+	/**
+	 * wait for the running lookups and stop the resolver threads
+	 */
+	void Shutdown();
+
+	bool SetOption(SM_SocketOption so, int value);
+
+	// lookups answered without querying the resolver, including the ones joining a running query
+	boost::atomic<uint32_t> cacheHits;
+	boost::atomic<uint32_t> cacheMisses;
+
+private:
+	struct Entry {
+		Entry() : pending(false) {}
+
+		ResolvedAddresses addresses;
+		boost::system::error_code errorCode;
+		boost::posix_time::ptime expiry;
+		bool pending;
+		std::vector<Handler> waiters;
+	};
+
+	static bool ParseNumeric(const char* hostname, ResolvedAddresses& addresses);
+	static boost::system::error_code Query(const std::string& hostname, ResolvedAddresses& addresses);
+
+	void Store(const std::string& hostname, const boost::system::error_code& errorCode, ResolvedAddresses addresses, std::vector<Handler>* waiters);
+	void MakeRoom(const boost::posix_time::ptime& now);
+
+	void QueryHandler(std::string hostname);
+	void StartThreads();
+	void RunResolveService();
+
+	boost::mutex cacheMutex;
+	std::map<std::string, Entry> cache;
+	int cacheTtl;
+	int negativeCacheTtl;
+
+	boost::mutex resolveThreadsMutex;
+	boost::asio::io_service* resolveService;
+	boost::asio::io_service::work* resolveWork;
+	std::vector<boost::thread*> resolveThreads;
+	unsigned int resolveThreadCount;
+};
+
+extern ResolverCache resolverCache;
+
+#endif
@@ -1,6 +1,8 @@
 #include "Socket.h"
 
 #include <assert.h>
+#include <algorithm>
+#include <cerrno>
 #include <cstdio>
 #include <exception>
 #include <boost/bind.hpp>
@@ -8,25 +10,100 @@
 #include "Callback.h"
 #include "CallbackHandler.h"
 #include "SocketHandler.h"
+#include "TimerWheel.h"
 
 using namespace boost::asio::ip;
 
+// capacity of the buffers asio reads into, including the \0 terminator added for the plugin
+#define RECEIVE_BUFFER_SIZE 16384
+#define MIN_RECEIVE_BUFFER_SIZE 512
+#define MAX_RECEIVE_BUFFER_SIZE 65536
+
+// maximum number of queued sends gathered into a single write
+#define MAX_SEND_GATHER 64
+
+// the readable socket is read without blocking in case the readiness was spurious, reading on
+// readiness is only available with MSG_DONTWAIT
+#ifdef MSG_DONTWAIT
+#define RECEIVE_NONBLOCKING_FLAGS MSG_DONTWAIT
+#endif
+
+// inline sends from the game thread must never block, they're only available with MSG_DONTWAIT
+#ifdef MSG_DONTWAIT
+#ifdef MSG_NOSIGNAL
+#define SEND_NONBLOCKING_FLAGS (MSG_DONTWAIT | MSG_NOSIGNAL)
+#else
+#define SEND_NONBLOCKING_FLAGS MSG_DONTWAIT
+#endif
+#endif
+
+// consecutive reads using less than a quarter of the buffer before the adaptive chunk size shrinks
+#define SMALL_RECEIVES_TO_SHRINK 16
+
+// milliseconds a connect attempt gets before the next resolved address is tried in parallel
+#define CONNECT_ATTEMPT_DELAY 250
+
+// milliseconds between the sweeps for idle accepted sockets
+#define LISTEN_REAP_INTERVAL 1000
+
+MemoryPool HandlerLock::pool(sizeof(HandlerLock), 1024);
+
 template <class SocketType>
 Socket<SocketType>::Socket(SM_SocketType st,
 						   typename SocketType::socket* asioSocket) : connectCallback(NULL),
 																	  incomingCallback(NULL),
+																	  incomingBatchCallback(NULL),
 																	  receiveCallback(NULL),
 																	  sendqueueEmptyCallback(NULL),
+																	  sendqueueLowCallback(NULL),
+																	  bindCallback(NULL),
 																	  disconnectCallback(NULL),
 																	  errorCallback(NULL),
 																	  smCallbackArg(0),
+																	  socketId(0),
 																	  sendQueueLength(0),
+																	  sendQueueBytes(0),
+																	  callbacksParked(false),
 																	  sm_sockettype(st),
 																	  socket(NULL),
 																	  localEndpoint(NULL),
 																	  localEndpointMutex(NULL),
 																	  tcpAcceptor(NULL),
-																	  tcpAcceptorMutex(NULL) {
+																	  tcpAcceptorMutex(NULL),
+																	  connecting(false),
+																	  connectRace(NULL),
+																	  connectGeneration(0),
+																	  listenShards(1),
+																	  listenPendingAccepts(1),
+																	  listenBacklog(0),
+																	  listenMaxIdleTime(0),
+																	  listenMaxConnections(0),
+																	  lastActivityTick(0),
+																	  strand(*socketHandler.ioService),
+																	  sendInProgress(false),
+																	  sendInProgressCount(0),
+																	  sendQueueMaxBytes(0),
+																	  sendQueueOverflowPolicy(SM_SendQueueOverflow_Fail),
+																	  sendQueueLowWatermark(0),
+																	  sendQueueLowPending(false),
+																	  sendInline(false),
+																	  receiveChunkSize(RECEIVE_BUFFER_SIZE),
+																	  adaptiveReceiveChunkSize(false),
+																	  smallReceiveCount(0),
+																	  receiveOnReadable(false),
+																	  receiveQueueHighWatermark(0),
+																	  receiveQueueLowWatermark(0),
+																	  receiveQueueLength(0),
+																	  receivePaused(false),
+																	  pausedReceiveHandlerLock(NULL),
+																	  connectTimeout(0),
+																	  receiveTimeout(0),
+																	  sendTimeout(0),
+																	  connectDeadline(0),
+																	  receiveDeadline(0),
+																	  sendDeadline(0),
+																	  reapDeadline(0),
+																	  scheduledTimeoutTick(0) {
 	if (asioSocket != NULL) {
 		socket = asioSocket;
 	}
@@ -34,6 +111,17 @@ Socket<SocketType>::Socket(SM_SocketType st,
 
 template <class SocketType>
 Socket<SocketType>::~Socket() {
+	// the listener's sweep may not pick this socket anymore
+	LeaveAcceptedSockets();
+
+	{ // lock
+		boost::mutex::scoped_lock l(socketMutex);
+
+		// the last attempt's handler deletes the race
+		connecting = false;
+		if (connectRace) FinishConnectRace(connectRace);
+	} // ~lock
+
 	if (socket) {
 		boost::mutex::scoped_lock l(socketMutex);
 		socket->close();
@@ -42,12 +130,20 @@ Socket<SocketType>::~Socket() {
 		socket = NULL;
 	}
 
+	// a paused receive holds a handler lock as well
+	ReleasePausedReceive();
+
 	if (tcpAcceptor) {
 		boost::mutex::scoped_lock l(*tcpAcceptorMutex);
 		tcpAcceptor->close();
 		
 		delete tcpAcceptor;
 		tcpAcceptor = NULL;
+
+		for (typename std::vector<ListenShard>::iterator it=tcpAcceptorShards.begin(); it!=tcpAcceptorShards.end(); it++) {
+			it->acceptor->close();
+			delete it->acceptor;
+		}
 	}
 	
 	if (localEndpoint) {
@@ -61,72 +157,479 @@ Socket<SocketType>::~Socket() {
 	//boost::unique_lock<boost::shared_mutex> l(handlerMutex);
 	handlerMutex.lock();
 
+	// TimeoutHandler() isn't covered by the handler lock
+	timerWheel.Cancel(this);
+
 	boost::mutex::scoped_lock socketLock(socketMutex);
 
 	if (tcpAcceptorMutex) delete tcpAcceptorMutex;
 	if (localEndpointMutex) delete localEndpointMutex;
 
+	// the shards may only go away after their handlers, their threads return once out of work
+	for (typename std::vector<ListenShard>::iterator it=tcpAcceptorShards.begin(); it!=tcpAcceptorShards.end(); it++) {
+		delete it->ioServiceWork;
+		it->thread->join();
+
+		delete it->thread;
+		delete it->strand;
+		delete it->ioService;
+	}
+
 	while (!socketOptionQueue.empty()) {
 		delete socketOptionQueue.front();
 		socketOptionQueue.pop();
 	}
+
+	for (std::deque<Buffer*>::iterator it=sendQueue.begin(); it!=sendQueue.end(); it++) {
+		(*it)->Release();
+	}
 }
 
+/**
+ * process a completed read and start the next one
+ *
+ * @param buf	buffer holding the data read, NULL if there's none (yet)
+ */
 template <class SocketType>
-void Socket<SocketType>::ReceiveHandler(char* buf, size_t bufferSize, size_t bytesTransferred, const boost::system::error_code& errorCode, boost::shared_lock<boost::shared_mutex>* handlerLock) {
+void Socket<SocketType>::ReceiveHandler(Buffer* buf, size_t bytesTransferred, const boost::system::error_code& errorCode, HandlerLock* handlerLock) {
 	if (!errorCode) {
 		boost::mutex::scoped_lock l(socketMutex);
 
-		if (socket) {
-			if (bytesTransferred) callbackHandler.AddCallback(new Callback(CallbackEvent_Receive, this, buf, bytesTransferred));
-
-			socket->async_receive(boost::asio::buffer(buf, bufferSize),
-								boost::bind(&Socket<SocketType>::ReceiveHandler,
-											this,
-											buf,
-											bufferSize,
-											boost::asio::placeholders::bytes_transferred,
-											boost::asio::placeholders::error,
-											handlerLock));
+		if (socket && socket->is_open()) {
+			if (bytesTransferred) {
+				if (adaptiveReceiveChunkSize) AdaptReceiveChunkSize(bytesTransferred, buf->GetCapacity()-1);
+
+				// hand the buffer over to the callback, the next read gets a new one
+				buf->SetLength(bytesTransferred);
+				buf->GetData()[bytesTransferred] = '\0';
+
+				socketHandler.receiveBufferBytes -= buf->GetCapacity();
+				receiveQueueLength += bytesTransferred;
+				callbackHandler.AddCallback(new Callback(CallbackEvent_Receive, socketId, buf));
+
+				buf = NULL;
+
+				if (acceptedBy) lastActivityTick = timerWheel.GetCurrentTick();
+
+				// the paused socket doesn't hold a buffer, parked callbacks pause it right away as
+				// the plugin may never take the data
+				if ((callbacksParked || (receiveQueueHighWatermark && receiveQueueLength >= receiveQueueHighWatermark)) && PauseReceive(handlerLock)) return;
+			}
+
+			ArmTimeout(receiveDeadline, receiveTimeout);
+
+			if (receiveOnReadable) {
+				// don't hold a buffer until there's something to read
+				if (buf) ReleaseReceiveBuffer(buf);
+
+				socket->async_receive(boost::asio::null_buffers(),
+									strand.wrap(boost::bind(&Socket<SocketType>::ReceiveReadableHandler,
+															this,
+															boost::asio::placeholders::error,
+															handlerLock)));
+			} else {
+				if (!buf) buf = CreateReceiveBuffer();
+
+				// keep room for the \0 terminator
+				socket->async_receive(boost::asio::buffer(buf->GetData(), buf->GetCapacity()-1),
+									strand.wrap(boost::bind(&Socket<SocketType>::ReceiveHandler,
+															this,
+															buf,
+															boost::asio::placeholders::bytes_transferred,
+															boost::asio::placeholders::error,
+															handlerLock)));
+			}
 			return;
 		}
 	}
 	
+	// the connection is over unless the socket has been closed locally, reaped ones are gone already
+	if (errorCode && errorCode != boost::asio::error::operation_aborted) LeaveAcceptedSockets();
+
 	if (errorCode) {
 		if (errorCode == boost::asio::error::eof ||
 			errorCode == boost::asio::error::connection_reset ||
 			errorCode == boost::asio::error::connection_aborted) {
 			// asio indicates disconnect
 
-			boost::mutex::scoped_lock l(socketMutex);
-			
-			if (socket) callbackHandler.AddCallback(new Callback(CallbackEvent_Disconnect, this));
+			callbackHandler.AddCallback(new Callback(CallbackEvent_Disconnect, socketId));
 
 		} else if (errorCode != boost::asio::error::operation_aborted) {
 			// error
 
-			boost::mutex::scoped_lock l(socketMutex);
-			
-			if (socket) callbackHandler.AddCallback(new Callback(CallbackEvent_Error, this, SM_ErrorType_RECV_ERROR, errorCode.value()));
+			callbackHandler.AddCallback(new Callback(CallbackEvent_Error, socketId, SM_ErrorType_RECV_ERROR, errorCode.value()));
 			
 		}
 	}
 	
-	delete[] buf;
+	if (buf) ReleaseReceiveBuffer(buf);
 	delete handlerLock;
 }
 
+#ifdef RECEIVE_NONBLOCKING_FLAGS
+/**
+ * read what's available without ever blocking, asio's receive() would wait for readiness on
+ * EAGAIN as the socket isn't in non-blocking mode from its point of view
+ *
+ * @return bytes read, would_block is set in errorCode if there was nothing to read
+ */
+template <class SocketType>
+static size_t ReceiveNonBlocking(typename SocketType::socket& socket, char* data, size_t length, boost::system::error_code& errorCode) {
+	ssize_t ret = ::recv(socket.native_handle(), data, length, RECEIVE_NONBLOCKING_FLAGS);
+
+	if (ret > 0) return ret;
+
+	if (ret == 0) {
+		// an empty datagram is fine, an empty read from a stream is the peer's shutdown
+		if (SocketType::v4().type() == SOCK_STREAM) errorCode = boost::asio::error::eof;
+	} else if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+		errorCode = boost::asio::error::would_block;
+	} else {
+		errorCode = boost::system::error_code(errno, boost::asio::error::get_system_category());
+	}
+
+	return 0;
+}
+#endif
+
+/**
+ * the socket became readable, read what's available into a buffer taken just now
+ */
+template <class SocketType>
+void Socket<SocketType>::ReceiveReadableHandler(const boost::system::error_code& errorCode, HandlerLock* handlerLock) {
+	if (errorCode) {
+		ReceiveHandler(NULL, 0, errorCode, handlerLock);
+		return;
+	}
+
+	Buffer* buf = CreateReceiveBuffer();
+	size_t bytesTransferred = 0;
+	boost::system::error_code receiveErrorCode;
+
+	{ // lock
+		boost::mutex::scoped_lock l(socketMutex);
+
+#ifdef RECEIVE_NONBLOCKING_FLAGS
+		if (socket) bytesTransferred = ReceiveNonBlocking<SocketType>(*socket, buf->GetData(), buf->GetCapacity()-1, receiveErrorCode);
+#else
+		receiveErrorCode = boost::asio::error::operation_not_supported;
+#endif
+	} // ~lock
+
+	// spurious readiness, ReceiveHandler() waits for the socket to become readable again
+	if (receiveErrorCode == boost::asio::error::would_block) receiveErrorCode = boost::system::error_code();
+
+	ReceiveHandler(buf, bytesTransferred, receiveErrorCode, handlerLock);
+}
+
+template <class SocketType>
+Buffer* Socket<SocketType>::CreateReceiveBuffer() {
+	Buffer* buf = Buffer::Create(receiveChunkSize);
+	socketHandler.receiveBufferBytes += buf->GetCapacity();
+
+	return buf;
+}
+
+template <class SocketType>
+void Socket<SocketType>::ReleaseReceiveBuffer(Buffer* buf) {
+	socketHandler.receiveBufferBytes -= buf->GetCapacity();
+	buf->Release();
+}
+
+/**
+ * double the chunk size if a read filled the buffer, halve it if reads keep using only a fraction
+ */
+template <class SocketType>
+void Socket<SocketType>::AdaptReceiveChunkSize(size_t bytesTransferred, size_t bufferSize) {
+	if (bytesTransferred >= bufferSize) {
+		smallReceiveCount = 0;
+		receiveChunkSize = std::min(receiveChunkSize * 2, (size_t) MAX_RECEIVE_BUFFER_SIZE);
+	} else if (bytesTransferred < bufferSize / 4) {
+		if (++smallReceiveCount >= SMALL_RECEIVES_TO_SHRINK) {
+			smallReceiveCount = 0;
+			receiveChunkSize = std::max(receiveChunkSize / 2, (size_t) MIN_RECEIVE_BUFFER_SIZE);
+		}
+	} else {
+		smallReceiveCount = 0;
+	}
+}
+
+/**
+ * stop reading until ReceiveDelivered() drops the receive queue length to the low watermark
+ *
+ * @return false if the receive queue has been drained in the meantime, continue reading
+ */
+template <class SocketType>
+bool Socket<SocketType>::PauseReceive(HandlerLock* handlerLock) {
+	pausedReceiveHandlerLock = handlerLock;
+	receivePaused = true;
+
+	// the game thread may have delivered the data already before seeing receivePaused
+	if (receiveQueueLength <= receiveQueueLowWatermark && receivePaused.exchange(false)) return false;
+
+	return true;
+}
+
+/**
+ * called by the game thread whenever received data is being passed to the plugin
+ */
+template <class SocketType>
+void Socket<SocketType>::ReceiveDelivered(size_t bytes) {
+	size_t length = (receiveQueueLength -= bytes);
+
+	if (length <= receiveQueueLowWatermark && receivePaused && receivePaused.exchange(false)) {
+		strand.post(boost::bind(&Socket<SocketType>::ReceiveHandler,
+								this,
+								(Buffer*) NULL,
+								0,
+								boost::system::error_code(),
+								pausedReceiveHandlerLock));
+	}
+}
+
+template <class SocketType>
+void Socket<SocketType>::ReleasePausedReceive() {
+	if (receivePaused.exchange(false)) {
+		delete pausedReceiveHandlerLock;
+	}
+}
+
+/**
+ * move deadline timeout milliseconds ahead, socketMutex has to be locked
+ */
+template <class SocketType>
+void Socket<SocketType>::ArmTimeout(uint64_t& deadline, unsigned int timeout) {
+	if (!timeout) {
+		deadline = 0;
+		return;
+	}
+
+	deadline = timerWheel.GetDeadline(timeout);
+
+	// a later deadline is picked up once the scheduled tick is reached
+	if (!scheduledTimeoutTick || deadline < scheduledTimeoutTick) {
+		scheduledTimeoutTick = deadline;
+		timerWheel.Schedule(this, deadline, boost::bind(&Socket<SocketType>::TimeoutHandler, this));
+	}
+}
+
+/**
+ * called by the timer wheel, closes the socket if one of the deadlines passed
+ */
+template <class SocketType>
+void Socket<SocketType>::TimeoutHandler() {
+	int expiredTimeout = 0;
+	bool reap = false;
+
+	{ // lock
+		boost::mutex::scoped_lock l(socketMutex);
+
+		uint64_t currentTick = timerWheel.GetCurrentTick();
+		scheduledTimeoutTick = 0;
+
+		if (reapDeadline && reapDeadline <= currentTick) {
+			reapDeadline = 0;
+			reap = true;
+		}
+
+		// drop the deadlines of operations not running anymore, a paused receive isn't idle
+		if (!connecting) connectDeadline = 0;
+		if (!socket || !socket->is_open() || receivePaused) receiveDeadline = 0;
+		if (!socket || !sendInProgress) sendDeadline = 0;
+
+		if (connectDeadline && connectDeadline <= currentTick) {
+			expiredTimeout = SM_SO_SocketConnectTimeout;
+
+			connecting = false;
+			if (connectRace) FinishConnectRace(connectRace);
+		} else if (receiveDeadline && receiveDeadline <= currentTick) {
+			expiredTimeout = SM_SO_SocketReceiveTimeout;
+		} else if (sendDeadline && sendDeadline <= currentTick) {
+			expiredTimeout = SM_SO_SocketSendTimeout;
+		}
+
+		if (expiredTimeout) {
+			// the pending operations complete with operation_aborted
+			if (socket && expiredTimeout != SM_SO_SocketConnectTimeout) {
+				boost::system::error_code ignoredErrorCode;
+				socket->close(ignoredErrorCode);
+			}
+
+			connectDeadline = receiveDeadline = sendDeadline = 0;
+		}
+
+		uint64_t nextDeadline = 0;
+
+		if (connectDeadline) nextDeadline = connectDeadline;
+		if (receiveDeadline && (!nextDeadline || receiveDeadline < nextDeadline)) nextDeadline = receiveDeadline;
+		if (sendDeadline && (!nextDeadline || sendDeadline < nextDeadline)) nextDeadline = sendDeadline;
+		if (reapDeadline && (!nextDeadline || reapDeadline < nextDeadline)) nextDeadline = reapDeadline;
+
+		if (nextDeadline) {
+			scheduledTimeoutTick = nextDeadline;
+			timerWheel.Schedule(this, nextDeadline, boost::bind(&Socket<SocketType>::TimeoutHandler, this));
+		}
+	} // ~lock
+
+	if (expiredTimeout) {
+		callbackHandler.AddCallback(new Callback(CallbackEvent_Error, socketId, SM_ErrorType_TIMEOUT_ERROR, expiredTimeout));
+	}
+
+	if (reap) ReapAcceptedSockets();
+}
+
+/**
+ * close the accepted sockets idle for longer than listenMaxIdleTime and the longest idle ones
+ * exceeding listenMaxConnections, runs on the timer wheel
+ */
+template <class SocketType>
+void Socket<SocketType>::ReapAcceptedSockets() {
+	if (!acceptedSockets) return;
+
+	// the reaped sockets are kept alive until their disconnect callbacks have been queued
+	std::vector<std::pair<uint32_t, HandlerLock*> > reapedSockets;
+
+	{ // lock
+		boost::mutex::scoped_lock l(acceptedSockets->mutex);
+
+		std::vector<Socket<SocketType>*>& sockets = acceptedSockets->sockets;
+		uint64_t currentTick = timerWheel.GetCurrentTick();
+		uint64_t maxIdleTicks = listenMaxIdleTime ? TimerWheel::GetTicks(listenMaxIdleTime) : 0;
+		size_t excess = (listenMaxConnections && sockets.size() > listenMaxConnections) ? sockets.size() - listenMaxConnections : 0;
+
+		// longest idle first
+		std::vector<std::pair<uint64_t, Socket<SocketType>*> > candidates;
+
+		for (typename std::vector<Socket<SocketType>*>::iterator it=sockets.begin(); it!=sockets.end(); it++) {
+			uint64_t lastActivity = (*it)->lastActivityTick;
+
+			if (excess || (maxIdleTicks && lastActivity + maxIdleTicks <= currentTick)) {
+				candidates.push_back(std::make_pair(lastActivity, *it));
+			}
+		}
+
+		std::sort(candidates.begin(), candidates.end());
+
+		std::vector<Socket<SocketType>*> removed;
+
+		for (size_t i = 0; i < candidates.size(); i++) {
+			bool idle = (maxIdleTicks && candidates[i].first + maxIdleTicks <= currentTick);
+			if (!idle && i >= excess) break;
+
+			Socket<SocketType>* acceptedSocket = candidates[i].second;
+
+			// closed sockets only still count until they're swept
+			// still listed, so its destructor is waiting for the mutex before taking handlerMutex
+			if (acceptedSocket->ReapConnection()) {
+				reapedSockets.push_back(std::make_pair(acceptedSocket->socketId, new HandlerLock(acceptedSocket->handlerMutex)));
+				acceptedSockets->reapedCount++;
+			}
+
+			removed.push_back(acceptedSocket);
+		}
+
+		if (!removed.empty()) {
+			std::sort(removed.begin(), removed.end());
+
+			size_t kept = 0;
+
+			for (size_t i = 0; i < sockets.size(); i++) {
+				if (!std::binary_search(removed.begin(), removed.end(), sockets[i])) sockets[kept++] = sockets[i];
+			}
+
+			sockets.resize(kept);
+		}
+	} // ~lock
+
+	for (size_t i = 0; i < reapedSockets.size(); i++) {
+		callbackHandler.AddCallback(new Callback(CallbackEvent_Disconnect, reapedSockets[i].first));
+		delete reapedSockets[i].second;
+	}
+
+	if (listenMaxIdleTime) {
+		boost::mutex::scoped_lock l(socketMutex);
+		ArmTimeout(reapDeadline, LISTEN_REAP_INTERVAL);
+	}
+}
+
+/**
+ * close the connection of an accepted socket picked by the listener's sweep, the listener's
+ * acceptedSockets mutex is locked
+ *
+ * @return false if it has been closed already
+ */
+template <class SocketType>
+bool Socket<SocketType>::ReapConnection() {
+	boost::mutex::scoped_lock l(socketMutex);
+
+	if (!socket || !socket->is_open()) return false;
+
+	// the pending read completes with operation_aborted
+	boost::system::error_code ignoredErrorCode;
+	socket->close(ignoredErrorCode);
+
+	return true;
+}
+
+/**
+ * stop counting an accepted socket as a connection of its listener
+ */
+template <class SocketType>
+void Socket<SocketType>::LeaveAcceptedSockets() {
+	if (!acceptedBy) return;
+
+	boost::mutex::scoped_lock l(acceptedBy->mutex);
+
+	std::vector<Socket<SocketType>*>& sockets = acceptedBy->sockets;
+	typename std::vector<Socket<SocketType>*>::iterator it = std::find(sockets.begin(), sockets.end(), this);
+
+	if (it != sockets.end()) {
+		*it = sockets.back();
+		sockets.pop_back();
+	}
+}
+
+template <class SocketType>
+size_t Socket<SocketType>::GetListenStatistic(SM_SocketStatistic ss) {
+	if (!acceptedSockets) return 0;
+
+	boost::mutex::scoped_lock l(acceptedSockets->mutex);
+
+	switch (ss) {
+		case SM_SS_ListenConnections:
+			return acceptedSockets->sockets.size();
+		case SM_SS_ListenPeakConnections:
+			return acceptedSockets->peakCount;
+		case SM_SS_ListenReapedConnections:
+			return acceptedSockets->reapedCount;
+		default:
+			return 0;
+	}
+}
+
 template <class SocketType>
 bool Socket<SocketType>::IsOpen() {
 	boost::mutex::scoped_lock l(socketMutex);
 
-	return (socket && socket->is_open());
+	// a connect in progress counts as open, like the socket opened right away used to
+	return (socket && socket->is_open()) || connecting;
+}
+
+/**
+ * local endpoints prefer IPv4 when a hostname resolves to both families, matching the sockets
+ * created without binding
+ */
+static boost::asio::ip::address SelectLocalAddress(const AddressList& addresses) {
+	for (AddressList::const_iterator it=addresses.begin(); it!=addresses.end(); it++) {
+		if (it->is_v4()) return *it;
+	}
+
+	return addresses.front();
 }
 
 template <class SocketType>
 bool Socket<SocketType>::Bind(const char* hostname, uint16_t port, bool async) {
-	typename SocketType::resolver* resolver = NULL;
-	boost::shared_lock<boost::shared_mutex>* handlerLock = NULL;
+	HandlerLock* handlerLock = NULL;
 
 	try {
 		if (localEndpoint) {
@@ -136,35 +639,45 @@ bool Socket<SocketType>::Bind(const char* hostname, uint16_t port, bool async) {
 			return false;
 		}
 
-		char sPort[6];
-		snprintf(sPort, sizeof(sPort), "%hu", port);
+		// numeric addresses don't need the resolver
+		boost::system::error_code addressErrorCode;
+		boost::asio::ip::address address = boost::asio::ip::address::from_string(hostname, addressErrorCode);
+
+		if (!addressErrorCode) {
+			localEndpointMutex = new boost::mutex();
+			boost::mutex::scoped_lock l(*localEndpointMutex);
+			localEndpoint = new typename SocketType::endpoint(address, port);
+
+			if (async && bindCallback) callbackHandler.AddCallback(new Callback(CallbackEvent_Bind, socketId));
+
+			return true;
+		}
 
 		if (async) {
-			resolver = new typename SocketType::resolver(*socketHandler.ioService);
-			handlerLock = new boost::shared_lock<boost::shared_mutex>(handlerMutex);
-
-			resolver->async_resolve(typename SocketType::resolver::query(SocketType::v4(), hostname, sPort),
-									boost::bind(&Socket<SocketType>::BindPostResolveHandler,
-												this,
-												resolver,
-												boost::asio::placeholders::iterator,
-												boost::asio::placeholders::error,
-												handlerLock));
+			handlerLock = new HandlerLock(handlerMutex);
+
+			resolverCache.AsyncResolve(hostname,
+									   strand.wrap(boost::bind(&Socket<SocketType>::BindPostResolveHandler,
+															   this,
+															   _1,
+															   _2,
+															   port,
+															   handlerLock)));
 		} else {
-			typename SocketType::resolver syncResolver(*socketHandler.ioService);
+			ResolvedAddresses addresses;
+			boost::system::error_code errorCode = resolverCache.Resolve(hostname, addresses);
 
-			typename SocketType::resolver::iterator endpointIterator = syncResolver.resolve(typename SocketType::resolver::query(SocketType::v4(), hostname, sPort));
+			if (errorCode) throw boost::system::system_error(errorCode);
 
 			if (!localEndpoint) {
 				localEndpointMutex = new boost::mutex();
 				boost::mutex::scoped_lock l(*localEndpointMutex);
-				localEndpoint = new typename SocketType::endpoint(endpointIterator->endpoint());
+				localEndpoint = new typename SocketType::endpoint(SelectLocalAddress(*addresses), port);
 			}
 		}
 
 		return true;
 	} catch (std::exception& e) {
-		if (resolver) delete resolver;
 		if (handlerLock) delete handlerLock;
 	}
 
@@ -172,56 +685,67 @@ bool Socket<SocketType>::Bind(const char* hostname, uint16_t port, bool async) {
 }
 
 template <class SocketType>
-void Socket<SocketType>::BindPostResolveHandler(typename SocketType::resolver* resolver, typename SocketType::resolver::iterator endpointIterator, const boost::system::error_code& errorCode, boost::shared_lock<boost::shared_mutex>* handlerLock) {
+void Socket<SocketType>::BindPostResolveHandler(const boost::system::error_code& errorCode, ResolvedAddresses addresses, uint16_t port, HandlerLock* handlerLock) {
 	if (!errorCode) {
 		if (!localEndpoint) {
 			localEndpointMutex = new boost::mutex();
 			boost::mutex::scoped_lock l(*localEndpointMutex);
-			localEndpoint = new typename SocketType::endpoint(*endpointIterator);
+			localEndpoint = new typename SocketType::endpoint(SelectLocalAddress(*addresses), port);
 		}
+
+		if (bindCallback) callbackHandler.AddCallback(new Callback(CallbackEvent_Bind, socketId));
 	} else if (errorCode != boost::asio::error::operation_aborted) {
-		callbackHandler.AddCallback(new Callback(CallbackEvent_Error, this, SM_ErrorType_BIND_ERROR, errorCode.value()));
+		callbackHandler.AddCallback(new Callback(CallbackEvent_Error, socketId, SM_ErrorType_BIND_ERROR, errorCode.value()));
 	}
 
-	delete resolver;
 	delete handlerLock;
 }
 
 template <class SocketType>
 bool Socket<SocketType>::Connect(const char* hostname, uint16_t port, bool async) {
-	typename SocketType::resolver* resolver = NULL;
-	boost::shared_lock<boost::shared_mutex>* handlerLock = NULL;
+	HandlerLock* handlerLock = NULL;
 
 	try {
-		char sPort[6];
-		snprintf(sPort, sizeof(sPort), "%hu", port);
+		if (async) {
+			uint32_t generation;
 
-		if (!socket) InitializeSocket();
+			{ // lock
+				boost::mutex::scoped_lock l(socketMutex);
 
-		if (async) {
-			resolver = new typename SocketType::resolver(*socketHandler.ioService);
-			handlerLock = new boost::shared_lock<boost::shared_mutex>(handlerMutex);
-
-			resolver->async_resolve(typename SocketType::resolver::query(SocketType::v4(), hostname, sPort),
-									boost::bind(&Socket<SocketType>::ConnectPostResolveHandler,
-												this,
-												resolver,
-												boost::asio::placeholders::iterator,
-												boost::asio::placeholders::error,
-												handlerLock));
+				if (connecting) return false;
+				connecting = true;
+				generation = ++connectGeneration;
+
+				ArmTimeout(connectDeadline, connectTimeout);
+			} // ~lock
+
+			handlerLock = new HandlerLock(handlerMutex);
+
+			resolverCache.AsyncResolve(hostname,
+									   strand.wrap(boost::bind(&Socket<SocketType>::ConnectPostResolveHandler,
+															   this,
+															   generation,
+															   _1,
+															   _2,
+															   port,
+															   handlerLock)));
 		} else {
-			typename SocketType::resolver syncResolver(*socketHandler.ioService);
+			ResolvedAddresses addresses;
+			boost::system::error_code error = resolverCache.Resolve(hostname, addresses);
+
+			if (error) throw boost::system::system_error(error);
 
-			typename SocketType::resolver::iterator endpointIterator = syncResolver.resolve(typename SocketType::resolver::query(SocketType::v4(), hostname, sPort));
+			std::vector<typename SocketType::endpoint> endpoints = OrderEndpoints(*addresses, port);
+			error = boost::asio::error::address_family_not_supported;
 
-			boost::system::error_code error = boost::asio::error::host_not_found;
-			typename SocketType::resolver::iterator end;
+			for (typename std::vector<typename SocketType::endpoint>::iterator it=endpoints.begin(); error && it!=endpoints.end(); it++) {
+				if (!socket) InitializeSocket(it->protocol());
 
-			while (error && endpointIterator != end) {
 				boost::mutex::scoped_lock l(socketMutex);
 
 				if (socket) {
-					socket->connect(*endpointIterator++, error);
+					// reopens the socket with the endpoint's protocol
+					socket->connect(*it, error);
 					if (error) socket->close();
 				} else {
 					throw std::logic_error("Operation cancelled.");
@@ -230,95 +754,273 @@ bool Socket<SocketType>::Connect(const char* hostname, uint16_t port, bool async
 
 			if (error) throw boost::system::system_error(error);
 
-			ReceiveHandler(new char[16384], 16384, 0, boost::system::posix_error::make_error_code(boost::system::posix_error::success), new boost::shared_lock<boost::shared_mutex>(handlerMutex));
+			ReceiveHandler(NULL, 0, boost::system::posix_error::make_error_code(boost::system::posix_error::success), new HandlerLock(handlerMutex));
 		}
 
 		return true;
 	} catch (std::exception& e) {
-		if (resolver) delete resolver;
-		if (handlerLock) delete handlerLock;
+		if (handlerLock) {
+			boost::mutex::scoped_lock l(socketMutex);
+			connecting = false;
+			delete handlerLock;
+		}
 	}
 
 	return false;
 }
 
 template <class SocketType>
-void Socket<SocketType>::ConnectPostResolveHandler(typename SocketType::resolver* resolver, typename SocketType::resolver::iterator endpointIterator, const boost::system::error_code& errorCode, boost::shared_lock<boost::shared_mutex>* handlerLock) {
-	if (!errorCode) {
-		typename SocketType::endpoint endpoint = *endpointIterator;
-		
+void Socket<SocketType>::ConnectPostResolveHandler(uint32_t generation, const boost::system::error_code& errorCode, ResolvedAddresses addresses, uint16_t port, HandlerLock* handlerLock) {
+	boost::system::error_code connectError = errorCode;
+
+	{ // lock
 		boost::mutex::scoped_lock l(socketMutex);
 
-		if (socket) {
-			socket->async_connect(endpoint,
-								boost::bind(&Socket<SocketType>::ConnectPostConnectHandler,
-											this,
-											resolver,
-											++endpointIterator,
-											boost::asio::placeholders::error,
-											handlerLock));
-			return;
+		// Disconnect() cancelled the connect while resolving, a following Connect() owns the state now
+		bool stale = (!connecting || generation != connectGeneration);
+		if (stale) connectError = boost::asio::error::operation_aborted;
+
+		if (!connectError) {
+			ConnectRace* race = new ConnectRace(*socketHandler.ioService);
+			race->endpoints = OrderEndpoints(*addresses, port);
+
+			StartConnectAttempt(race);
+
+			if (race->pendingOperations) {
+				connectRace = race;
+			} else {
+				// none of the endpoints could be used
+				connectError = race->lastError ? race->lastError : boost::asio::error::address_family_not_supported;
+				delete race;
+			}
 		}
+
+		if (connectError && !stale) connecting = false;
+	} // ~lock
+
+	if (connectError && connectError != boost::asio::error::operation_aborted) {
+		callbackHandler.AddCallback(new Callback(CallbackEvent_Error, socketId, SM_ErrorType_CONNECT_ERROR, connectError.value()));
 	}
-	
-	if (errorCode && errorCode != boost::asio::error::operation_aborted) {
+
+	delete handlerLock;
+}
+
+/**
+ * open a socket for the next usable endpoint and start connecting it, socketMutex has to be locked
+ */
+template <class SocketType>
+void Socket<SocketType>::StartConnectAttempt(ConnectRace* race) {
+	bool boundToPort = false;
+
+	while (race->nextEndpoint < race->endpoints.size()) {
+		const typename SocketType::endpoint& endpoint = race->endpoints[race->nextEndpoint++];
+		typename SocketType::socket* attempt = new typename SocketType::socket(*socketHandler.ioService);
+		boost::system::error_code errorCode;
+
+		attempt->open(endpoint.protocol(), errorCode);
+
+		if (!errorCode && localEndpoint) {
+			boost::mutex::scoped_lock l(*localEndpointMutex);
+
+			if (localEndpoint) {
+				attempt->bind(*localEndpoint, errorCode);
+				boundToPort = (localEndpoint->port() != 0);
+			}
+		}
+
+		if (errorCode) {
+			race->lastError = errorCode;
+			delete attempt;
+			continue;
+		}
+
+		ApplySocketOptions(attempt);
+
+		race->attempts.push_back(attempt);
+		race->pendingOperations++;
+
+		attempt->async_connect(endpoint,
+							   strand.wrap(boost::bind(&Socket<SocketType>::ConnectAttemptHandler,
+													   this,
+													   race,
+													   attempt,
+													   boost::asio::placeholders::error,
+													   new HandlerLock(handlerMutex))));
+
+		// race the next endpoint if this one doesn't connect in time, attempts can't share a bound port
+		if (race->nextEndpoint < race->endpoints.size() && !boundToPort) {
+			race->staggerTimer.expires_from_now(boost::posix_time::milliseconds(CONNECT_ATTEMPT_DELAY));
+			race->pendingOperations++;
+
+			race->staggerTimer.async_wait(strand.wrap(boost::bind(&Socket<SocketType>::ConnectStaggerHandler,
+																  this,
+																  race,
+																  boost::asio::placeholders::error,
+																  new HandlerLock(handlerMutex))));
+		}
+
+		return;
+	}
+}
+
+template <class SocketType>
+void Socket<SocketType>::ConnectAttemptHandler(ConnectRace* race, typename SocketType::socket* attempt, const boost::system::error_code& errorCode, HandlerLock* handlerLock) {
+	bool connected = false;
+	boost::system::error_code connectError;
+
+	{ // lock
 		boost::mutex::scoped_lock l(socketMutex);
 
-		if (socket) callbackHandler.AddCallback(new Callback(CallbackEvent_Error, this, SM_ErrorType_CONNECT_ERROR, errorCode.value()));
+		race->pendingOperations--;
+		race->attempts.erase(std::find(race->attempts.begin(), race->attempts.end(), attempt));
+
+		if (!errorCode && !race->finished) {
+			FinishConnectRace(race);
+			connecting = false;
+
+			// replaces the socket closed by Disconnect() when reconnecting
+			if (socket) delete socket;
+
+			socket = attempt;
+			attempt = NULL;
+
+			while (!socketOptionQueue.empty()) {
+				SetOption(socketOptionQueue.front()->option, socketOptionQueue.front()->value, false);
+				delete socketOptionQueue.front();
+				socketOptionQueue.pop();
+			}
+
+			connected = true;
+		} else if (!race->finished) {
+			boost::system::error_code ignoredErrorCode;
+			attempt->close(ignoredErrorCode);
+
+			if (errorCode != boost::asio::error::operation_aborted) {
+				race->lastError = errorCode;
+
+				// no need to wait for the stagger delay after a failure
+				StartConnectAttempt(race);
+			}
+
+			if (race->attempts.empty() && race->nextEndpoint >= race->endpoints.size()) {
+				FinishConnectRace(race);
+				connecting = false;
+				connectError = race->lastError;
+			}
+		}
+
+		if (race->finished && !race->pendingOperations) {
+			if (connectRace == race) connectRace = NULL;
+			delete race;
+		}
+	} // ~lock
+
+	if (attempt) delete attempt;
+
+	if (connected) {
+		callbackHandler.AddCallback(new Callback(CallbackEvent_Connect, socketId));
+
+		ReceiveHandler(NULL, 0, boost::system::posix_error::make_error_code(boost::system::posix_error::success), handlerLock);
+
+		return;
+	}
+
+	if (connectError) {
+		callbackHandler.AddCallback(new Callback(CallbackEvent_Error, socketId, SM_ErrorType_CONNECT_ERROR, connectError.value()));
 	}
 
-	delete resolver;
 	delete handlerLock;
 }
 
 template <class SocketType>
-void Socket<SocketType>::ConnectPostConnectHandler(typename SocketType::resolver* resolver, typename SocketType::resolver::iterator endpointIterator, const boost::system::error_code& errorCode, boost::shared_lock<boost::shared_mutex>* handlerLock) {
-	if (!errorCode) {
-		{ // lock
-			boost::mutex::scoped_lock l(socketMutex);
+void Socket<SocketType>::ConnectStaggerHandler(ConnectRace* race, const boost::system::error_code& errorCode, HandlerLock* handlerLock) {
+	{ // lock
+		boost::mutex::scoped_lock l(socketMutex);
+
+		race->pendingOperations--;
+
+		if (!errorCode && !race->finished) StartConnectAttempt(race);
+
+		if (race->finished && !race->pendingOperations) {
+			if (connectRace == race) connectRace = NULL;
+			delete race;
+		}
+	} // ~lock
+
+	delete handlerLock;
+}
+
+/**
+ * stop the race, the remaining attempts complete with operation_aborted, socketMutex has to be
+ * locked
+ */
+template <class SocketType>
+void Socket<SocketType>::FinishConnectRace(ConnectRace* race) {
+	boost::system::error_code ignoredErrorCode;
+
+	race->finished = true;
+
+	for (typename std::vector<typename SocketType::socket*>::iterator it=race->attempts.begin(); it!=race->attempts.end(); it++) {
+		(*it)->close(ignoredErrorCode);
+	}
+
+	race->staggerTimer.cancel(ignoredErrorCode);
+}
+
+/**
+ * alternate between the address families starting with the family of the first address
+ * (RFC 8305 section 4), only the family of a bound local endpoint can be used
+ */
+template <class SocketType>
+std::vector<typename SocketType::endpoint> Socket<SocketType>::OrderEndpoints(const AddressList& addresses, uint16_t port) {
+	bool bound = false;
+	bool boundV6 = false;
+
+	if (localEndpoint) {
+		boost::mutex::scoped_lock l(*localEndpointMutex);
 
-			if (socket) {
-				callbackHandler.AddCallback(new Callback(CallbackEvent_Connect, this));
-			}
-		} // ~lock
+		if (localEndpoint) {
+			bound = true;
+			boundV6 = localEndpoint->address().is_v6();
+		}
+	}
 
-		ReceiveHandler(new char[16384], 16384, 0, boost::system::posix_error::make_error_code(boost::system::posix_error::success), handlerLock);
-		
-		delete resolver;
-			
-		return;
-	} else if (endpointIterator != typename SocketType::resolver::iterator()) {
-		{ // lock
-			boost::mutex::scoped_lock l(socketMutex);
+	std::vector<boost::asio::ip::address> preferred;
+	std::vector<boost::asio::ip::address> other;
 
-			if (socket) {
-				socket->close();
-			}
-		} // ~lock
+	for (AddressList::const_iterator it=addresses.begin(); it!=addresses.end(); it++) {
+		if (bound && it->is_v6() != boundV6) continue;
 
-		ConnectPostResolveHandler(resolver, endpointIterator, boost::system::posix_error::make_error_code(boost::system::posix_error::success), handlerLock);
-			
-		return;
+		if (preferred.empty() || it->is_v6() == preferred.front().is_v6()) {
+			preferred.push_back(*it);
+		} else {
+			other.push_back(*it);
+		}
 	}
 
-	if (errorCode && errorCode != boost::asio::error::operation_aborted) {
-		boost::mutex::scoped_lock l(socketMutex);
+	std::vector<typename SocketType::endpoint> endpoints;
 
-		if (socket) callbackHandler.AddCallback(new Callback(CallbackEvent_Error, this, SM_ErrorType_CONNECT_ERROR, errorCode.value()));
+	for (size_t i = 0; i < preferred.size() || i < other.size(); i++) {
+		if (i < preferred.size()) endpoints.push_back(typename SocketType::endpoint(preferred[i], port));
+		if (i < other.size()) endpoints.push_back(typename SocketType::endpoint(other[i], port));
 	}
 
-	delete resolver;
-	delete handlerLock;
+	return endpoints;
 }
 
 template <class SocketType>
 bool Socket<SocketType>::Disconnect() {
 	boost::mutex::scoped_lock l(socketMutex);
 
-	if (!socket) return false;
+	if (!socket && !connecting) return false;
 
 	try {
-		socket->close();
+		// cancel a connect in progress
+		connecting = false;
+		if (connectRace) FinishConnectRace(connectRace);
+
+		if (socket) socket->close();
+		ReleasePausedReceive();
 
 		return true;
 	} catch (std::exception& e) {
@@ -332,11 +1034,50 @@ bool Socket<SocketType>::Listen() {
 	return false;
 }
 
-template<> void Socket<tcp>::ListenIncomingHandler(tcp::socket* newAsioSocket, const boost::system::error_code& errorCode, boost::shared_lock<boost::shared_mutex>* handlerLock);
+template<> void Socket<tcp>::ListenIncomingHandler(tcp::acceptor* acceptor, boost::asio::io_service::strand* acceptorStrand, tcp::socket* newAsioSocket, const boost::system::error_code& errorCode, HandlerLock* handlerLock);
+
+#ifdef SO_REUSEPORT
+typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+#endif
+
+/**
+ * open an acceptor on endpoint, reusePort allows other acceptors to share the endpoint
+ */
+static tcp::acceptor* CreateAcceptor(boost::asio::io_service& ioService, const tcp::endpoint& endpoint, int backlog, bool reusePort) {
+	tcp::acceptor* acceptor = new tcp::acceptor(ioService);
+
+	try {
+		acceptor->open(endpoint.protocol());
+		acceptor->set_option(boost::asio::socket_base::reuse_address(true));
+
+		// accept IPv4 connections on IPv6 wildcard endpoints as well, not supported everywhere
+		if (endpoint.address().is_v6()) {
+			boost::system::error_code ignoredErrorCode;
+			acceptor->set_option(boost::asio::ip::v6_only(false), ignoredErrorCode);
+		}
+#ifdef SO_REUSEPORT
+		if (reusePort) acceptor->set_option(reuse_port(true));
+#endif
+		acceptor->bind(endpoint);
+		acceptor->listen(backlog ? backlog : boost::asio::socket_base::max_connections);
+	} catch (std::exception& e) {
+		delete acceptor;
+		throw;
+	}
+
+	return acceptor;
+}
+
+/**
+ * thread of a listen shard, accepts on the shard's own io service
+ */
+static void RunListenShard(boost::asio::io_service* ioService) {
+	ioService->run();
+}
 
 template<>
 bool Socket<tcp>::Listen() {
-	boost::shared_lock<boost::shared_mutex>* handlerLock = NULL;
+	HandlerLock* handlerLock = NULL;
 	tcp::socket* nextAsioSocket = NULL;
 
 	try {
@@ -348,27 +1089,62 @@ bool Socket<tcp>::Listen() {
 			boost::mutex::scoped_lock tcpAcceptorLock(*tcpAcceptorMutex);
 			boost::mutex::scoped_lock locelEndpointLock(*localEndpointMutex);
 
-			tcpAcceptor = new tcp::acceptor(*socketHandler.ioService, *localEndpoint);
+			tcpAcceptor = CreateAcceptor(*socketHandler.ioService, *localEndpoint, listenBacklog, listenShards > 1);
+
+			while (tcpAcceptorShards.size() < listenShards-1) {
+				ListenShard shard;
+				shard.ioService = new boost::asio::io_service();
+
+				try {
+					shard.acceptor = CreateAcceptor(*shard.ioService, *localEndpoint, listenBacklog, true);
+				} catch (std::exception& e) {
+					delete shard.ioService;
+					throw;
+				}
+
+				shard.ioServiceWork = new boost::asio::io_service::work(*shard.ioService);
+				shard.strand = new boost::asio::io_service::strand(*shard.ioService);
+				shard.thread = new boost::thread(boost::bind(&RunListenShard, shard.ioService));
+				tcpAcceptorShards.push_back(shard);
+			}
 
 			while (!socketOptionQueue.empty()) {
 				SetOption(socketOptionQueue.front()->option, socketOptionQueue.front()->value, false);
 				delete socketOptionQueue.front();
 				socketOptionQueue.pop();
 			}
+
+			acceptedSockets.reset(new AcceptedSockets());
+		}
+
+		if (listenMaxIdleTime) {
+			boost::mutex::scoped_lock l(socketMutex);
+			ArmTimeout(reapDeadline, LISTEN_REAP_INTERVAL);
 		}
 	
 		boost::mutex::scoped_lock l(*tcpAcceptorMutex);
 
-		handlerLock = new boost::shared_lock<boost::shared_mutex>(handlerMutex);
-
-		nextAsioSocket = new tcp::socket(*socketHandler.ioService);
-
-		tcpAcceptor->async_accept(*nextAsioSocket,
-								  boost::bind(&Socket<tcp>::ListenIncomingHandler,
-											  this,
-											  nextAsioSocket,
-											  boost::asio::placeholders::error,
-											  handlerLock));
+		for (size_t i = 0; i <= tcpAcceptorShards.size(); i++) {
+			tcp::acceptor* acceptor = i ? tcpAcceptorShards[i-1].acceptor : tcpAcceptor;
+			boost::asio::io_service::strand* acceptorStrand = i ? tcpAcceptorShards[i-1].strand : &strand;
+
+			for (unsigned int j = 0; j < listenPendingAccepts; j++) {
+				handlerLock = new HandlerLock(handlerMutex);
+
+				nextAsioSocket = new tcp::socket(*socketHandler.ioService);
+
+				acceptor->async_accept(*nextAsioSocket,
+									   acceptorStrand->wrap(boost::bind(&Socket<tcp>::ListenIncomingHandler,
+																		this,
+																		acceptor,
+																		acceptorStrand,
+																		nextAsioSocket,
+																		boost::asio::placeholders::error,
+																		handlerLock)));
+				handlerLock = NULL;
+				nextAsioSocket = NULL;
+			}
+		}
 
 		return true;
 	} catch (std::exception& e) {
@@ -380,105 +1156,311 @@ bool Socket<tcp>::Listen() {
 }
 
 template <class SocketType>
-void Socket<SocketType>::ListenIncomingHandler(tcp::socket* newAsioSocket, const boost::system::error_code& errorCode, boost::shared_lock<boost::shared_mutex>* handlerLock) {
+void Socket<SocketType>::ListenIncomingHandler(tcp::acceptor* acceptor, boost::asio::io_service::strand* acceptorStrand, tcp::socket* newAsioSocket, const boost::system::error_code& errorCode, HandlerLock* handlerLock) {
 	// invalid
 }
 template<>
-void Socket<tcp>::ListenIncomingHandler(tcp::socket* newAsioSocket, const boost::system::error_code& errorCode, boost::shared_lock<boost::shared_mutex>* handlerLock) {
+void Socket<tcp>::ListenIncomingHandler(tcp::acceptor* acceptor, boost::asio::io_service::strand* acceptorStrand, tcp::socket* newAsioSocket, const boost::system::error_code& errorCode, HandlerLock* handlerLock) {
 	if (!errorCode) {
-		boost::mutex::scoped_lock l(*tcpAcceptorMutex);
+		bool listening;
+
+		{ // lock
+			boost::mutex::scoped_lock l(*tcpAcceptorMutex);
+
+			// the shards are closed together with tcpAcceptor
+			listening = (tcpAcceptor != NULL);
+
+			if (listening) {
+				// accept the next connection before setting up this one
+				tcp::socket* nextAsioSocket = new tcp::socket(*socketHandler.ioService);
+
+				acceptor->async_accept(*nextAsioSocket,
+									   acceptorStrand->wrap(boost::bind(&Socket<tcp>::ListenIncomingHandler,
+																		this,
+																		acceptor,
+																		acceptorStrand,
+																		nextAsioSocket,
+																		boost::asio::placeholders::error,
+																		new HandlerLock(handlerMutex))));
+			}
+		} // ~lock
+
+		boost::system::error_code endpointErrorCode;
+		tcp::endpoint remoteEndpoint = newAsioSocket->remote_endpoint(endpointErrorCode);
 
-		if (tcpAcceptor) {
+		// report IPv4 clients of a dual-stack acceptor with their plain IPv4 address
+		if (remoteEndpoint.address().is_v6() && remoteEndpoint.address().to_v6().is_v4_mapped()) {
+			remoteEndpoint.address(remoteEndpoint.address().to_v6().to_v4());
+		}
+
+		// the connection may have been reset already
+		if (listening && !endpointErrorCode) {
 			Socket<tcp>* newSocket = socketHandler.CreateSocket<tcp>(sm_sockettype);
 			newSocket->socket = newAsioSocket;
-			callbackHandler.AddCallback(new Callback(CallbackEvent_Incoming, this, newSocket, newAsioSocket->remote_endpoint()));
+			newSocket->receiveChunkSize = receiveChunkSize;
+			newSocket->adaptiveReceiveChunkSize = adaptiveReceiveChunkSize;
+			newSocket->receiveOnReadable = receiveOnReadable;
+			newSocket->sendInline = sendInline;
+			newSocket->receiveTimeout = receiveTimeout;
+			newSocket->sendTimeout = sendTimeout;
+
+			// tracked before the plugin gets the handle, it may close it right away
+			bool overLimit;
+
+			newSocket->lastActivityTick = timerWheel.GetCurrentTick();
+			newSocket->acceptedBy = acceptedSockets;
 
-			newSocket->ReceiveHandler(new char[16384], 16384, 0, boost::system::posix_error::make_error_code(boost::system::posix_error::success), new boost::shared_lock<boost::shared_mutex>(newSocket->handlerMutex));
+			{ // lock
+				boost::mutex::scoped_lock l(acceptedSockets->mutex);
+
+				acceptedSockets->sockets.push_back(newSocket);
+				acceptedSockets->peakCount = std::max(acceptedSockets->peakCount, acceptedSockets->sockets.size());
+				overLimit = (listenMaxConnections && acceptedSockets->sockets.size() > listenMaxConnections);
+			} // ~lock
+
+			// sweep on the next tick instead of waiting for the regular one
+			if (overLimit) {
+				boost::mutex::scoped_lock l(socketMutex);
+				ArmTimeout(reapDeadline, 1);
+			}
+			callbackHandler.AddCallback(new Callback(CallbackEvent_Incoming, socketId, newSocket->socketId, remoteEndpoint));
 
-			tcp::socket* nextAsioSocket = new tcp::socket(*socketHandler.ioService);
+			newSocket->ReceiveHandler(NULL, 0, boost::system::posix_error::make_error_code(boost::system::posix_error::success), new HandlerLock(newSocket->handlerMutex));
 
-			tcpAcceptor->async_accept(*nextAsioSocket,
-									  boost::bind(&Socket<tcp>::ListenIncomingHandler,
-												  this,
-												  nextAsioSocket,
-												  boost::asio::placeholders::error,
-												  handlerLock));
+			delete handlerLock;
 			return;
 		}
 	}
 
 	if (errorCode && errorCode != boost::asio::error::operation_aborted) {
-		callbackHandler.AddCallback(new Callback(CallbackEvent_Error, this, SM_ErrorType_LISTEN_ERROR, errorCode.value()));
+		callbackHandler.AddCallback(new Callback(CallbackEvent_Error, socketId, SM_ErrorType_LISTEN_ERROR, errorCode.value()));
 	}
 
 	delete newAsioSocket;
 	delete handlerLock;
 }
 
+template<> void Socket<tcp>::StartSend(HandlerLock* handlerLock);
+
+#ifdef SEND_NONBLOCKING_FLAGS
+/**
+ * write what fits without ever blocking, asio's send() would wait for writability on EAGAIN as
+ * the socket isn't in non-blocking mode from its point of view
+ *
+ * @return bytes written, would_block is set in errorCode if nothing could be written
+ */
 template <class SocketType>
-bool Socket<SocketType>::Send(const std::string& data, bool async) {
-	char* buf = NULL;
-	boost::shared_lock<boost::shared_mutex>* handlerLock = NULL;
+static size_t SendNonBlocking(typename SocketType::socket& socket, const char* data, size_t length, boost::system::error_code& errorCode) {
+	ssize_t ret = ::send(socket.native_handle(), data, length, SEND_NONBLOCKING_FLAGS);
+
+	if (ret >= 0) return ret;
+
+	if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+		errorCode = boost::asio::error::would_block;
+	} else {
+		errorCode = boost::system::error_code(errno, boost::asio::error::get_system_category());
+	}
+
+	return 0;
+}
+#endif
+
+/**
+ * queue or send the data in buf, takes over the caller's reference
+ */
+template <class SocketType>
+bool Socket<SocketType>::Send(Buffer* buf, bool async) {
+	size_t length = buf->GetLength();
 
 	try {
 		if (!socket && !tcpAcceptor) throw std::logic_error("can't send without connection");
 
+		boost::mutex::scoped_lock l(socketMutex);
+
+		if (!socket) throw std::logic_error("Operation cancelled.");
+
+		if (acceptedBy) lastActivityTick = timerWheel.GetCurrentTick();
+
 		if (async) {
-			char* buf = new char[data.length()];
-			memcpy(buf, data.data(), data.length());
+#ifdef SEND_NONBLOCKING_FLAGS
+			// nothing queued, try to write right away and leave only the rest to the io threads
+			if (sendInline && !sendInProgress) {
+				boost::system::error_code inlineErrorCode;
+				size_t bytesSent = SendNonBlocking<SocketType>(*socket, buf->GetData(), length, inlineErrorCode);
+
+				// would_block queues the whole buffer, other errors are reported by the queued write
+				if (!inlineErrorCode && bytesSent > 0) {
+					socketHandler.sendOperations++;
+
+					if (bytesSent == length) {
+						buf->Release();
+						socketHandler.sendRequests++;
+
+						if (sendQueueLength == 0 && sendqueueEmptyCallback) {
+							callbackHandler.AddCallback(new Callback(CallbackEvent_SendQueueEmpty, socketId));
+						}
+
+						return true;
+					}
+
+					length -= bytesSent;
+					memmove(buf->GetData(), buf->GetData() + bytesSent, length);
+					buf->SetLength(length);
+				}
+			}
+#endif
 
-			sendQueueLength++;
+			if (sendQueueMaxBytes && !MakeSendQueueRoom(length)) throw std::length_error("Send queue full.");
 
-			handlerLock = new boost::shared_lock<boost::shared_mutex>(handlerMutex);
+			sendQueue.push_back(buf);
+			buf = NULL;
+			sendQueueLength++;
+			sendQueueBytes += length;
+			socketHandler.sendRequests++;
 
-			boost::mutex::scoped_lock l(socketMutex);
+			if (sendQueueLowWatermark && sendQueueBytes > sendQueueLowWatermark) sendQueueLowPending = true;
 
-			if (socket) {
-				socket->async_send(boost::asio::buffer(buf, data.length()),
-								   boost::bind(&Socket<SocketType>::SendPostSendHandler,
-											   this,
-											   buf,
-											   boost::asio::placeholders::bytes_transferred,
-											   boost::asio::placeholders::error,
-											   handlerLock));
-			} else {
-				throw new std::logic_error("Operation cancelled.");
-			}
+			// the running write picks the data up once it's done
+			if (!sendInProgress) StartSend(new HandlerLock(handlerMutex));
 		} else {
-			boost::mutex::scoped_lock l(socketMutex);
-
-			if (socket) {
-				socket->send(boost::asio::buffer(data, data.length()));
-			} else {
-				throw std::logic_error("Operation cancelled.");
-			}
+			socket->send(boost::asio::buffer(buf->GetData(), length));
+			buf->Release();
+			buf = NULL;
 		}
 
 		return true;
 	} catch (std::exception& e) {
-		if (buf) delete[] buf;
-		if (handlerLock) delete handlerLock;
+		if (buf) buf->Release();
 	}
 
 	return false;
 }
 
+/**
+ * apply the overflow policy for adding bytes to the send queue, socketMutex has to be locked
+ *
+ * @return false if the data doesn't fit
+ */
 template <class SocketType>
-void Socket<SocketType>::SendPostSendHandler(char* buf, size_t bytesTransferred, const boost::system::error_code& errorCode, boost::shared_lock<boost::shared_mutex>* handlerLock) {
-// TODO: handle incomplete sends
-	if (--sendQueueLength == 0 && sendqueueEmptyCallback) {
+bool Socket<SocketType>::MakeSendQueueRoom(size_t bytes) {
+	if (sendQueueBytes + bytes <= sendQueueMaxBytes) return true;
+	if (sendQueueOverflowPolicy != SM_SendQueueOverflow_DropOldest) return false;
+
+	// the data being written right now can't be dropped anymore
+	while (sendQueue.size() > sendInProgressCount && sendQueueBytes + bytes > sendQueueMaxBytes) {
+		Buffer* buf = sendQueue[sendInProgressCount];
+
+		sendQueueBytes -= buf->GetLength();
+		sendQueueLength--;
+		socketHandler.sendQueueDroppedBytes += buf->GetLength();
+
+		buf->Release();
+		sendQueue.erase(sendQueue.begin() + sendInProgressCount);
+	}
+
+	return (sendQueueBytes + bytes <= sendQueueMaxBytes);
+}
+
+/**
+ * write the queued data, socketMutex has to be locked
+ *
+ * Datagrams have to be sent one by one, see the specialization for streams.
+ */
+template <class SocketType>
+void Socket<SocketType>::StartSend(HandlerLock* handlerLock) {
+	Buffer* buf = sendQueue.front();
+
+	sendInProgress = true;
+	sendInProgressCount = 1;
+	socketHandler.sendOperations++;
+
+	ArmTimeout(sendDeadline, sendTimeout);
+
+	socket->async_send(boost::asio::buffer(buf->GetData(), buf->GetLength()),
+					   strand.wrap(boost::bind(&Socket<SocketType>::SendPostSendHandler,
+											   this,
+											   1,
+											   boost::asio::placeholders::bytes_transferred,
+											   boost::asio::placeholders::error,
+											   handlerLock)));
+}
+
+/**
+ * gather all queued data into a single write, async_write() takes care of partial writes
+ */
+template<>
+void Socket<tcp>::StartSend(HandlerLock* handlerLock) {
+	size_t count = std::min(sendQueue.size(), (size_t) MAX_SEND_GATHER);
+
+	std::vector<boost::asio::const_buffer> buffers;
+	buffers.reserve(count);
+
+	for (size_t i = 0; i < count; i++) {
+		buffers.push_back(boost::asio::buffer(sendQueue[i]->GetData(), sendQueue[i]->GetLength()));
+	}
+
+	sendInProgress = true;
+	sendInProgressCount = count;
+	socketHandler.sendOperations++;
+
+	ArmTimeout(sendDeadline, sendTimeout);
+
+	boost::asio::async_write(*socket,
+							 buffers,
+							 strand.wrap(boost::bind(&Socket<tcp>::SendPostSendHandler,
+													 this,
+													 count,
+													 boost::asio::placeholders::bytes_transferred,
+													 boost::asio::placeholders::error,
+													 handlerLock)));
+}
+
+template <class SocketType>
+void Socket<SocketType>::SendPostSendHandler(size_t buffersSent, size_t bytesTransferred, const boost::system::error_code& errorCode, HandlerLock* handlerLock) {
+	bool sendQueueLow = false;
+
+	{ // lock
 		boost::mutex::scoped_lock l(socketMutex);
 
-		if (socket) callbackHandler.AddCallback(new Callback(CallbackEvent_SendQueueEmpty, this));
+		// the connection is unusable after an error, drop everything
+		if (errorCode) buffersSent = sendQueue.size();
+
+		for (size_t i = 0; i < buffersSent; i++) {
+			sendQueueBytes -= sendQueue.front()->GetLength();
+			sendQueue.front()->Release();
+			sendQueue.pop_front();
+		}
+
+		sendQueueLength -= buffersSent;
+		sendInProgressCount = 0;
+
+		if (sendQueueLowPending && sendQueueBytes <= sendQueueLowWatermark) {
+			sendQueueLowPending = false;
+			sendQueueLow = true;
+		}
+
+		if (!sendQueue.empty() && socket) {
+			if (sendQueueLow && sendqueueLowCallback) callbackHandler.AddCallback(new Callback(CallbackEvent_SendQueueLow, socketId));
+
+			StartSend(handlerLock);
+			return;
+		}
+
+		sendInProgress = false;
+	} // ~lock
+
+	if (sendQueueLow && sendqueueLowCallback) {
+		callbackHandler.AddCallback(new Callback(CallbackEvent_SendQueueLow, socketId));
+	}
+
+	if (sendQueueLength == 0 && sendqueueEmptyCallback) {
+		callbackHandler.AddCallback(new Callback(CallbackEvent_SendQueueEmpty, socketId));
 	}
 
 	if (errorCode && errorCode != boost::asio::error::operation_aborted) {
-		boost::mutex::scoped_lock l(socketMutex);
-		
-		if (socket) callbackHandler.AddCallback(new Callback(CallbackEvent_Error, this, SM_ErrorType_SEND_ERROR, errorCode.value()));
+		callbackHandler.AddCallback(new Callback(CallbackEvent_Error, socketId, SM_ErrorType_SEND_ERROR, errorCode.value()));
 	}
 
-	delete[] buf;
 	delete handlerLock;
 }
 
@@ -490,13 +1472,9 @@ bool Socket<SocketType>::SendTo(const std::string& data, const char* hostname, u
 template <>
 bool Socket<udp>::SendTo(const std::string& data, const char* hostname, uint16_t port, bool async) {
 	char* buf = NULL;
-	udp::resolver* resolver = NULL;
-	boost::shared_lock<boost::shared_mutex>* handlerLock = NULL;
+	HandlerLock* handlerLock = NULL;
 
 	try {
-		char sPort[6];
-		snprintf(sPort, sizeof(sPort), "%hu", port);
-
 		if (!socket) InitializeSocket();
 
 		if (async) {
@@ -504,28 +1482,38 @@ bool Socket<udp>::SendTo(const std::string& data, const char* hostname, uint16_t
 			memcpy(buf, data.data(), data.length());
 
 			sendQueueLength++;
-
-			resolver = new udp::resolver(*socketHandler.ioService);
-			handlerLock = new boost::shared_lock<boost::shared_mutex>(handlerMutex);
-
-			resolver->async_resolve(udp::resolver::query(udp::v4(), hostname, sPort),
-									boost::bind(&Socket<udp>::SendToPostResolveHandler,
-												this,
-												resolver,
-												boost::asio::placeholders::iterator,
-												buf,
-												data.length(),
-												boost::asio::placeholders::error,
-												handlerLock));
+			sendQueueBytes += data.length();
+			socketHandler.sendRequests++;
+
+			handlerLock = new HandlerLock(handlerMutex);
+
+			resolverCache.AsyncResolve(hostname,
+									   strand.wrap(boost::bind(&Socket<udp>::SendToPostResolveHandler,
+															   this,
+															   _1,
+															   _2,
+															   (size_t) 0,
+															   port,
+															   buf,
+															   data.length(),
+															   handlerLock)));
 		} else {
-			udp::resolver syncResolver(*socketHandler.ioService);
+			ResolvedAddresses addresses;
+			boost::system::error_code errorCode = resolverCache.Resolve(hostname, addresses);
 
-			udp::resolver::iterator endpointIterator = syncResolver.resolve(udp::resolver::query(udp::v4(), hostname, sPort));
+			if (errorCode) throw boost::system::system_error(errorCode);
 
 			boost::mutex::scoped_lock l(socketMutex);
 
 			if (socket) {
-				socket->send_to(boost::asio::buffer(data, data.length()), *endpointIterator);
+				// the socket was opened for a single address family
+				bool v6 = socket->local_endpoint().address().is_v6();
+				AddressList::const_iterator it = addresses->begin();
+				while (it != addresses->end() && it->is_v6() != v6) it++;
+
+				if (it == addresses->end()) throw boost::system::system_error(boost::asio::error::address_family_not_supported);
+
+				socket->send_to(boost::asio::buffer(data, data.length()), udp::endpoint(*it, port));
 			} else {
 				throw std::logic_error("Operation cancelled.");
 			}
@@ -533,8 +1521,10 @@ bool Socket<udp>::SendTo(const std::string& data, const char* hostname, uint16_t
 
 		return true;
 	} catch (std::exception& e) {
-		if (resolver) delete resolver;
-		if (buf) delete[] buf;
+		if (buf) {
+			SendToCompleted(data.length());
+			delete[] buf;
+		}
 		if (handlerLock) delete handlerLock;
 	}
 
@@ -542,169 +1532,280 @@ bool Socket<udp>::SendTo(const std::string& data, const char* hostname, uint16_t
 }
 
 template <class SocketType>
-void Socket<SocketType>::SendToPostResolveHandler(typename SocketType::resolver* resolver, typename SocketType::resolver::iterator endpointIterator, char* buf, size_t bufLen, const boost::system::error_code& errorCode, boost::shared_lock<boost::shared_mutex>* handlerLock) {
-	if (!errorCode) {
-		typename SocketType::endpoint endpoint = *endpointIterator;
+bool Socket<SocketType>::SendTo(Buffer* buf, const udp::endpoint& endpoint) {
+	buf->Release();
+	return false;
+}
+
+/**
+ * send buf to an already resolved endpoint, takes over the caller's reference
+ */
+template <>
+bool Socket<udp>::SendTo(Buffer* buf, const udp::endpoint& endpoint) {
+	size_t length = buf->GetLength();
+	HandlerLock* handlerLock = NULL;
+
+	try {
+		if (!socket) InitializeSocket(endpoint.protocol());
+
+		boost::mutex::scoped_lock l(socketMutex);
+
+		if (!socket) throw std::logic_error("Operation cancelled.");
+
+		handlerLock = new HandlerLock(handlerMutex);
+
+		// account before the handler can possibly run
+		sendQueueLength++;
+		sendQueueBytes += length;
+		socketHandler.sendRequests++;
+		socketHandler.sendOperations++;
+
+		socket->async_send_to(boost::asio::buffer(buf->GetData(), length),
+							  endpoint,
+							  strand.wrap(boost::bind(&Socket<udp>::SendToEndpointPostSendHandler,
+													  this,
+													  buf,
+													  boost::asio::placeholders::bytes_transferred,
+													  boost::asio::placeholders::error,
+													  handlerLock)));
+
+		return true;
+	} catch (std::exception& e) {
+		if (handlerLock) {
+			SendToCompleted(length);
+			delete handlerLock;
+		}
+		buf->Release();
+	}
+
+	return false;
+}
+
+template <class SocketType>
+void Socket<SocketType>::SendToPostResolveHandler(const boost::system::error_code& errorCode, ResolvedAddresses addresses, size_t addressIndex, uint16_t port, char* buf, size_t bufLen, HandlerLock* handlerLock) {
+	boost::system::error_code resolveError = errorCode;
 
+	if (!resolveError) {
 		boost::mutex::scoped_lock l(socketMutex);
 
 		if (socket) {
+			// skip the addresses of the family the socket wasn't opened for
+			boost::system::error_code endpointErrorCode;
+			bool v6 = socket->local_endpoint(endpointErrorCode).address().is_v6();
+			while (addressIndex < addresses->size() && (*addresses)[addressIndex].is_v6() != v6) addressIndex++;
+		}
+
+		if (socket && addressIndex < addresses->size()) {
+			typename SocketType::endpoint endpoint((*addresses)[addressIndex], port);
+
+			socketHandler.sendOperations++;
+
 			socket->async_send_to(boost::asio::buffer(buf, bufLen),
 								endpoint,
-								boost::bind(&Socket<SocketType>::SendToPostSendHandler,
-											this,
-											resolver,
-											++endpointIterator,
-											buf,
-											bufLen,
-											boost::asio::placeholders::bytes_transferred,
-											boost::asio::placeholders::error,
-											handlerLock));
+								strand.wrap(boost::bind(&Socket<SocketType>::SendToPostSendHandler,
+														this,
+														addresses,
+														addressIndex + 1,
+														port,
+														buf,
+														bufLen,
+														boost::asio::placeholders::bytes_transferred,
+														boost::asio::placeholders::error,
+														handlerLock)));
 			return;
 		}
-	}
-
 
+		if (socket) resolveError = boost::asio::error::address_family_not_supported;
+	}
 
-	if (errorCode && errorCode != boost::asio::error::operation_aborted) {
-		boost::mutex::scoped_lock l(socketMutex);
-		
-		if (socket) callbackHandler.AddCallback(new Callback(CallbackEvent_Error, this, SM_ErrorType_NO_HOST, errorCode.value()));
+	if (resolveError && resolveError != boost::asio::error::operation_aborted) {
+		callbackHandler.AddCallback(new Callback(CallbackEvent_Error, socketId, SM_ErrorType_NO_HOST, resolveError.value()));
 	}
+
+	SendToCompleted(bufLen);
 	
-	delete resolver;
 	delete[] buf;
 	delete handlerLock;
 }
 
 template <class SocketType>
-void Socket<SocketType>::SendToPostSendHandler(typename SocketType::resolver* resolver, typename SocketType::resolver::iterator endpointIterator, char* buf, size_t bufLen, size_t bytesTransferred, const boost::system::error_code& errorCode, boost::shared_lock<boost::shared_mutex>* handlerLock) {
-	if (!errorCode) {
-		if (--sendQueueLength == 0 && sendqueueEmptyCallback) {
-			boost::mutex::scoped_lock l(socketMutex);
-		
-			if (socket) callbackHandler.AddCallback(new Callback(CallbackEvent_SendQueueEmpty, this));
-		}
-
-	} else if (endpointIterator != typename SocketType::resolver::iterator()) {
-		SendToPostResolveHandler(resolver, endpointIterator, buf, bufLen, boost::system::posix_error::make_error_code(boost::system::posix_error::success), handlerLock);
+void Socket<SocketType>::SendToPostSendHandler(ResolvedAddresses addresses, size_t addressIndex, uint16_t port, char* buf, size_t bufLen, size_t bytesTransferred, const boost::system::error_code& errorCode, HandlerLock* handlerLock) {
+	if (errorCode && addressIndex < addresses->size()) {
+		SendToPostResolveHandler(boost::system::posix_error::make_error_code(boost::system::posix_error::success), addresses, addressIndex, port, buf, bufLen, handlerLock);
 		return;
-		
-	} else {
-		if (errorCode != boost::asio::error::operation_aborted) {
-			boost::mutex::scoped_lock l(socketMutex);
-		
-			if (socket) callbackHandler.AddCallback(new Callback(CallbackEvent_Error, this, SM_ErrorType_SEND_ERROR, errorCode.value()));
-		}
 	}
 
-	delete resolver;
+	if (errorCode && errorCode != boost::asio::error::operation_aborted) {
+		callbackHandler.AddCallback(new Callback(CallbackEvent_Error, socketId, SM_ErrorType_SEND_ERROR, errorCode.value()));
+	}
+
+	SendToCompleted(bufLen);
+
 	delete[] buf;
 	delete handlerLock;
 }
 
+template <class SocketType>
+void Socket<SocketType>::SendToEndpointPostSendHandler(Buffer* buf, size_t bytesTransferred, const boost::system::error_code& errorCode, HandlerLock* handlerLock) {
+	if (errorCode && errorCode != boost::asio::error::operation_aborted) {
+		callbackHandler.AddCallback(new Callback(CallbackEvent_Error, socketId, SM_ErrorType_SEND_ERROR, errorCode.value()));
+	}
+
+	SendToCompleted(buf->GetLength());
+
+	buf->Release();
+	delete handlerLock;
+}
+
+/**
+ * account a finished SendTo() whether it succeeded or not
+ */
+template <class SocketType>
+void Socket<SocketType>::SendToCompleted(size_t bytes) {
+	sendQueueBytes -= bytes;
+
+	if (--sendQueueLength == 0 && sendqueueEmptyCallback) {
+		callbackHandler.AddCallback(new Callback(CallbackEvent_SendQueueEmpty, socketId));
+	}
+}
+
 template <class SocketType>
 bool Socket<SocketType>::SetOption(SM_SocketOption so, int value, bool lock) {
 	boost::mutex::scoped_lock* l = NULL;
 
+	// extension level socket options
+	switch (so) {
+		case SM_SO_ReceiveQueueHighWatermark:
+			if (value < 0) return false;
+			receiveQueueHighWatermark = value;
+			if (!receiveQueueLowWatermark || receiveQueueLowWatermark >= receiveQueueHighWatermark) receiveQueueLowWatermark = receiveQueueHighWatermark / 2;
+			return true;
+		case SM_SO_ReceiveQueueLowWatermark:
+			if (value < 0 || (receiveQueueHighWatermark && (size_t) value >= receiveQueueHighWatermark)) return false;
+			receiveQueueLowWatermark = value;
+			return true;
+		case SM_SO_ListenShards:
+#ifdef SO_REUSEPORT
+			if (value < 1 || value > 32 || tcpAcceptor) return false;
+			listenShards = value;
+			return true;
+#else
+			return false;
+#endif
+		case SM_SO_ReceiveChunkSize:
+			if (value < MIN_RECEIVE_BUFFER_SIZE || value > MAX_RECEIVE_BUFFER_SIZE) return false;
+			receiveChunkSize = value;
+			return true;
+		case SM_SO_AdaptiveReceiveChunkSize:
+			adaptiveReceiveChunkSize = (value != 0);
+			return true;
+		case SM_SO_ReceiveOnReadable:
+#ifdef RECEIVE_NONBLOCKING_FLAGS
+			receiveOnReadable = (value != 0);
+			return true;
+#else
+			return false;
+#endif
+		case SM_SO_SendQueueMaxBytes:
+			if (value < 0) return false;
+			sendQueueMaxBytes = value;
+			return true;
+		case SM_SO_SendQueueOverflowPolicy:
+			if (value != SM_SendQueueOverflow_Fail && value != SM_SendQueueOverflow_DropOldest) return false;
+			sendQueueOverflowPolicy = (SM_SendQueueOverflow) value;
+			return true;
+		case SM_SO_SendQueueLowWatermark:
+			if (value < 0) return false;
+			sendQueueLowWatermark = value;
+			return true;
+		case SM_SO_SendInline:
+#ifdef SEND_NONBLOCKING_FLAGS
+			sendInline = (value != 0);
+			return true;
+#else
+			return false;
+#endif
+		case SM_SO_ListenPendingAccepts:
+			if (value < 1 || value > 64 || tcpAcceptor) return false;
+			listenPendingAccepts = value;
+			return true;
+		case SM_SO_ListenBacklog:
+			if (value < 0 || tcpAcceptor) return false;
+			listenBacklog = value;
+			return true;
+		case SM_SO_ListenMaxIdleTime: {
+			if (value < 0) return false;
+
+			boost::mutex::scoped_lock timeoutLock(socketMutex);
+			listenMaxIdleTime = value;
+			if (acceptedSockets) ArmTimeout(reapDeadline, listenMaxIdleTime ? LISTEN_REAP_INTERVAL : 0);
+
+			return true;
+		}
+		case SM_SO_ListenMaxConnections: {
+			if (value < 0) return false;
+
+			boost::mutex::scoped_lock timeoutLock(socketMutex);
+			listenMaxConnections = value;
+			if (acceptedSockets && listenMaxConnections) ArmTimeout(reapDeadline, 1);
+
+			return true;
+		}
+		case SM_SO_SocketConnectTimeout: {
+			if (value < 0) return false;
+
+			boost::mutex::scoped_lock timeoutLock(socketMutex);
+			connectTimeout = value;
+			if (connecting) ArmTimeout(connectDeadline, connectTimeout);
+
+			return true;
+		}
+		case SM_SO_SocketReceiveTimeout: {
+			if (value < 0) return false;
+
+			boost::mutex::scoped_lock timeoutLock(socketMutex);
+			receiveTimeout = value;
+			if (socket && socket->is_open()) ArmTimeout(receiveDeadline, receiveTimeout);
+
+			return true;
+		}
+		case SM_SO_SocketSendTimeout: {
+			if (value < 0) return false;
+
+			boost::mutex::scoped_lock timeoutLock(socketMutex);
+			sendTimeout = value;
+			if (sendInProgress) ArmTimeout(sendDeadline, sendTimeout);
+
+			return true;
+		}
+		default:
+			break;
+	}
+
 	try {
 		if (socket) {
 			if (lock) l = new boost::mutex::scoped_lock(socketMutex);
 			if (!socket) return false;
 
-			switch (so) {
-				case SM_SO_SocketBroadcast:
-					socket->set_option(boost::asio::socket_base::broadcast(value!=0));
-					break;
-				case SM_SO_SocketReuseAddr:
-					socket->set_option(boost::asio::socket_base::reuse_address(value!=0));
-					break;
-				case SM_SO_SocketKeepAlive:
-					socket->set_option(boost::asio::socket_base::keep_alive(value!=0));
-					break;
-				case SM_SO_SocketLinger:
-					socket->set_option(boost::asio::socket_base::linger(value>0, value));
-					break;
-				case SM_SO_SocketOOBInline:
-					// TODO: implement?
-					if (l) delete l;
-					return false;
-				case SM_SO_SocketSendBuffer:
-					socket->set_option(boost::asio::socket_base::send_buffer_size(value));
-					break;
-				case SM_SO_SocketReceiveBuffer:
-					socket->set_option(boost::asio::socket_base::receive_buffer_size(value));
-					break;
-				case SM_SO_SocketDontRoute:
-					socket->set_option(boost::asio::socket_base::do_not_route(value!=0));
-					break;
-				case SM_SO_SocketReceiveLowWatermark:
-					socket->set_option(boost::asio::socket_base::receive_low_watermark(value));
-					break;
-				case SM_SO_SocketReceiveTimeout:
-					// TODO: implement?
-					if (l) delete l;
-					return false;
-				case SM_SO_SocketSendLowWatermark:
-					socket->set_option(boost::asio::socket_base::send_low_watermark(value));
-					break;
-				case SM_SO_SocketSendTimeout:
-					// TODO: implement?
-					if (l) delete l;
-					return false;
-				default:
-					if (l) delete l;
-					return false;
-			}
+			bool ret = SetSocketOption(socket, so, value);
+
+			if (l) delete l;
+			return ret;
 		} else if (tcpAcceptor) {
 			if (lock) l = new boost::mutex::scoped_lock(*tcpAcceptorMutex);
 			if (!tcpAcceptor) return false;
 
-			switch (so) {
-				case SM_SO_SocketBroadcast:
-					tcpAcceptor->set_option(boost::asio::socket_base::broadcast(value!=0));
-					break;
-				case SM_SO_SocketReuseAddr:
-					tcpAcceptor->set_option(boost::asio::socket_base::reuse_address(value!=0));
-					break;
-				case SM_SO_SocketKeepAlive:
-					tcpAcceptor->set_option(boost::asio::socket_base::keep_alive(value!=0));
-					break;
-				case SM_SO_SocketLinger:
-					tcpAcceptor->set_option(boost::asio::socket_base::linger(value>0, value));
-					break;
-				case SM_SO_SocketOOBInline:
-					// TODO: implement?
-					if (l) delete l;
-					return false;
-				case SM_SO_SocketSendBuffer:
-					tcpAcceptor->set_option(boost::asio::socket_base::send_buffer_size(value));
-					break;
-				case SM_SO_SocketReceiveBuffer:
-					tcpAcceptor->set_option(boost::asio::socket_base::receive_buffer_size(value));
-					break;
-				case SM_SO_SocketDontRoute:
-					tcpAcceptor->set_option(boost::asio::socket_base::do_not_route(value!=0));
-					break;
-				case SM_SO_SocketReceiveLowWatermark:
-					tcpAcceptor->set_option(boost::asio::socket_base::receive_low_watermark(value));
-					break;
-				case SM_SO_SocketReceiveTimeout:
-					// TODO: implement?
-					if (l) delete l;
-					return false;
-				case SM_SO_SocketSendLowWatermark:
-					tcpAcceptor->set_option(boost::asio::socket_base::send_low_watermark(value));
-					break;
-				case SM_SO_SocketSendTimeout:
-					// TODO: implement?
-					if (l) delete l;
-					return false;
-				default:
+			// apply to all acceptors listening on the endpoint
+			for (size_t i = 0; i <= tcpAcceptorShards.size(); i++) {
+				boost::asio::ip::tcp::acceptor* acceptor = i ? tcpAcceptorShards[i-1].acceptor : tcpAcceptor;
+
+				if (!SetSocketOption(acceptor, so, value)) {
 					if (l) delete l;
 					return false;
+				}
 			}
 		} else {
+			// connect attempts in progress pick the option up once they're connected
 			socketOptionQueue.push(new SocketOption(so, value));
 		}
 
@@ -716,8 +1817,68 @@ bool Socket<SocketType>::SetOption(SM_SocketOption so, int value, bool lock) {
 	}
 }
 
+/**
+ * apply a native socket option to a socket or acceptor, throws on failure
+ *
+ * @return false if the option isn't supported
+ */
+template <class SocketType>
+template <class AsioSocket>
+bool Socket<SocketType>::SetSocketOption(AsioSocket* asioSocket, SM_SocketOption so, int value) {
+	switch (so) {
+		case SM_SO_SocketBroadcast:
+			asioSocket->set_option(boost::asio::socket_base::broadcast(value!=0));
+			return true;
+		case SM_SO_SocketReuseAddr:
+			asioSocket->set_option(boost::asio::socket_base::reuse_address(value!=0));
+			return true;
+		case SM_SO_SocketKeepAlive:
+			asioSocket->set_option(boost::asio::socket_base::keep_alive(value!=0));
+			return true;
+		case SM_SO_SocketLinger:
+			asioSocket->set_option(boost::asio::socket_base::linger(value>0, value));
+			return true;
+		case SM_SO_SocketOOBInline:
+			// TODO: implement?
+			return false;
+		case SM_SO_SocketSendBuffer:
+			asioSocket->set_option(boost::asio::socket_base::send_buffer_size(value));
+			return true;
+		case SM_SO_SocketReceiveBuffer:
+			asioSocket->set_option(boost::asio::socket_base::receive_buffer_size(value));
+			return true;
+		case SM_SO_SocketDontRoute:
+			asioSocket->set_option(boost::asio::socket_base::do_not_route(value!=0));
+			return true;
+		case SM_SO_SocketReceiveLowWatermark:
+			asioSocket->set_option(boost::asio::socket_base::receive_low_watermark(value));
+			return true;
+		case SM_SO_SocketSendLowWatermark:
+			asioSocket->set_option(boost::asio::socket_base::send_low_watermark(value));
+			return true;
+		default:
+			return false;
+	}
+}
+
+/**
+ * apply the queued options to a connect attempt, the queue is kept for the other attempts,
+ * socketMutex has to be locked
+ */
+template <class SocketType>
+void Socket<SocketType>::ApplySocketOptions(typename SocketType::socket* asioSocket) {
+	std::queue<SocketOption*> options(socketOptionQueue);
+
+	for (; !options.empty(); options.pop()) {
+		try {
+			SetSocketOption(asioSocket, options.front()->option, options.front()->value);
+		} catch (std::exception& e) {
+		}
+	}
+}
+
 template <class SocketType>
-void Socket<SocketType>::InitializeSocket() {
+void Socket<SocketType>::InitializeSocket(const SocketType& protocol) {
 	assert(!socket);
 
 	boost::mutex::scoped_lock l(socketMutex);
@@ -729,13 +1890,13 @@ void Socket<SocketType>::InitializeSocket() {
 			if (localEndpoint) {
 				socket = new typename SocketType::socket(*socketHandler.ioService, *localEndpoint);
 			} else {
-				socket = new typename SocketType::socket(*socketHandler.ioService, typename SocketType::endpoint(SocketType::v4(), 0));
+				socket = new typename SocketType::socket(*socketHandler.ioService, typename SocketType::endpoint(protocol, 0));
 			}
 		} else {
 			socket = new typename SocketType::socket(*socketHandler.ioService);
 		}
 		
-		if (!socket->is_open()) socket->open(SocketType::v4());
+		if (!socket->is_open()) socket->open(protocol);
 
 		while (!socketOptionQueue.empty()) {
 			SetOption(socketOptionQueue.front()->option, socketOptionQueue.front()->value, false);
@@ -751,9 +1912,12 @@ template bool Socket<tcp>::IsOpen();
 template bool Socket<tcp>::Bind(const char*, uint16_t, bool);
 template bool Socket<tcp>::Connect(const char*, uint16_t, bool);
 template bool Socket<tcp>::Disconnect();
-template bool Socket<tcp>::Send(const std::string&, bool);
+template bool Socket<tcp>::Send(Buffer*, bool);
 template bool Socket<tcp>::SendTo(const std::string&, const char*, uint16_t, bool);
+template bool Socket<tcp>::SendTo(Buffer*, const udp::endpoint&);
 template bool Socket<tcp>::SetOption(SM_SocketOption, int, bool);
+template void Socket<tcp>::ReceiveDelivered(size_t);
+template size_t Socket<tcp>::GetListenStatistic(SM_SocketStatistic);
 
 template Socket<udp>::Socket(SM_SocketType, udp::socket*);
 template Socket<udp>::~Socket();
@@ -762,6 +1926,8 @@ template bool Socket<udp>::Bind(const char*, uint16_t, bool);
 template bool Socket<udp>::Connect(const char*, uint16_t, bool);
 template bool Socket<udp>::Disconnect();
 template bool Socket<udp>::Listen();
-template bool Socket<udp>::Send(const std::string&, bool);
+template bool Socket<udp>::Send(Buffer*, bool);
 template bool Socket<udp>::SetOption(SM_SocketOption, int, bool);
+template void Socket<udp>::ReceiveDelivered(size_t);
+template size_t Socket<udp>::GetListenStatistic(SM_SocketStatistic);
 
@@ -3,16 +3,36 @@
 
 #include <stdint.h>
 #include <string>
+#include <deque>
 #include <queue>
+#include <vector>
 #include <boost/asio.hpp>
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
 #include <boost/thread/shared_mutex.hpp>
 
 #include "sdk/smsdk_ext.h"
+#include "Buffer.h"
 #include "Define.h"
+#include "Pool.h"
+#include "ResolverCache.h"
 
 class SocketHandler;
 
+/**
+ * shared lock on Socket::handlerMutex held by every pending asio handler, allocated from a pool
+ */
+class HandlerLock : public boost::shared_lock<boost::shared_mutex> {
+public:
+	HandlerLock(boost::shared_mutex& handlerMutex) : boost::shared_lock<boost::shared_mutex>(handlerMutex) {}
+
+	static void* operator new(size_t size) { return pool.Allocate(size); }
+	static void operator delete(void* p, size_t size) { pool.Free(p, size); }
+
+	static MemoryPool pool;
+};
+
 template <class SocketType>
 class Socket {
 public:
@@ -25,38 +45,96 @@ public:
 	bool Connect(const char* hostname, uint16_t port, bool async = true);
 	bool Disconnect();
 	bool Listen();
-	bool Send(const std::string& data, bool async = true);
+	bool Send(Buffer* buf, bool async = true);
 	bool SendTo(const std::string& data, const char* hostname, uint16_t port, bool async = true);
+	bool SendTo(Buffer* buf, const boost::asio::ip::udp::endpoint& endpoint);
 	bool SetOption(SM_SocketOption so, int value, bool lock=true);
 
+	void ReceiveDelivered(size_t bytes);
+	size_t GetReceiveChunkSize() const { return receiveChunkSize; }
+
+	/**
+	 * @return lock keeping the socket alive for an operation that reports to it from elsewhere
+	 */
+	HandlerLock* CreateHandlerLock() { return new HandlerLock(handlerMutex); }
+	size_t GetListenStatistic(SM_SocketStatistic ss);
+
 	IPluginFunction* connectCallback;
 	IPluginFunction* incomingCallback;
+	IPluginFunction* incomingBatchCallback;
 	IPluginFunction* receiveCallback;
 	IPluginFunction* sendqueueEmptyCallback;
+	IPluginFunction* sendqueueLowCallback;
+	IPluginFunction* bindCallback;
 	IPluginFunction* disconnectCallback;
 	IPluginFunction* errorCallback;
 
 	int32_t smHandle;
 	int32_t smCallbackArg;
-	volatile unsigned int sendQueueLength;
+	uint32_t socketId;
+	boost::atomic<unsigned int> sendQueueLength; // sends not completed yet
+	boost::atomic<size_t> sendQueueBytes;
+	boost::atomic<bool> callbacksParked; // set by CallbackHandler, reading pauses while it's set
 
 private:
-	void ReceiveHandler(char* buf, size_t bufferSize, size_t bytes, const boost::system::error_code&, boost::shared_lock<boost::shared_mutex>*);
-
-	void BindPostResolveHandler(typename SocketType::resolver*, typename SocketType::resolver::iterator, const boost::system::error_code&, boost::shared_lock<boost::shared_mutex>*);
-
-	void ConnectPostResolveHandler(typename SocketType::resolver*, typename SocketType::resolver::iterator, const boost::system::error_code&, boost::shared_lock<boost::shared_mutex>*);
-	void ConnectPostConnectHandler(typename SocketType::resolver*, typename SocketType::resolver::iterator, const boost::system::error_code&, boost::shared_lock<boost::shared_mutex>*);
-
-	void ListenIncomingHandler(boost::asio::ip::tcp::socket* newAsioSocket, const boost::system::error_code&, boost::shared_lock<boost::shared_mutex>*);
-
-	void SendPostSendHandler(char* buf, size_t bytes, const boost::system::error_code& err, boost::shared_lock<boost::shared_mutex>*);
-
-	void SendToPostResolveHandler(typename SocketType::resolver*, typename SocketType::resolver::iterator, char* buf, size_t bufLen, const boost::system::error_code&, boost::shared_lock<boost::shared_mutex>*);
-	void SendToPostSendHandler(typename SocketType::resolver*, typename SocketType::resolver::iterator, char* buf, size_t bufLen, size_t bytesTransferred, const boost::system::error_code&, boost::shared_lock<boost::shared_mutex>*);
+	void ArmTimeout(uint64_t& deadline, unsigned int timeout);
+	void TimeoutHandler();
+
+	void ReapAcceptedSockets();
+	bool ReapConnection();
+	void LeaveAcceptedSockets();
+
+	void ReceiveHandler(Buffer* buf, size_t bytes, const boost::system::error_code&, HandlerLock*);
+	void ReceiveReadableHandler(const boost::system::error_code&, HandlerLock*);
+	bool PauseReceive(HandlerLock* handlerLock);
+	void ReleasePausedReceive();
+	Buffer* CreateReceiveBuffer();
+	void ReleaseReceiveBuffer(Buffer* buf);
+	void AdaptReceiveChunkSize(size_t bytesTransferred, size_t bufferSize);
+
+	void BindPostResolveHandler(const boost::system::error_code&, ResolvedAddresses, uint16_t port, HandlerLock*);
+
+	/**
+	 * Happy Eyeballs (RFC 8305) connect race over the resolved endpoints, a new attempt starts
+	 * after each stagger delay or once an attempt failed, the first connected attempt wins
+	 */
+	struct ConnectRace {
+		ConnectRace(boost::asio::io_service& ioService) : nextEndpoint(0),
+														  pendingOperations(0),
+														  finished(false),
+														  staggerTimer(ioService) {}
+
+		std::vector<typename SocketType::endpoint> endpoints;
+		size_t nextEndpoint;
+		std::vector<typename SocketType::socket*> attempts;
+		size_t pendingOperations; // attempts and the stagger timer
+		bool finished;
+		boost::system::error_code lastError;
+		boost::asio::deadline_timer staggerTimer;
+	};
+
+	void ConnectPostResolveHandler(uint32_t generation, const boost::system::error_code&, ResolvedAddresses, uint16_t port, HandlerLock*);
+	void StartConnectAttempt(ConnectRace* race);
+	void ConnectAttemptHandler(ConnectRace* race, typename SocketType::socket* attempt, const boost::system::error_code&, HandlerLock*);
+	void ConnectStaggerHandler(ConnectRace* race, const boost::system::error_code&, HandlerLock*);
+	void FinishConnectRace(ConnectRace* race);
+	std::vector<typename SocketType::endpoint> OrderEndpoints(const AddressList& addresses, uint16_t port);
+
+	void ListenIncomingHandler(boost::asio::ip::tcp::acceptor* acceptor, boost::asio::io_service::strand* acceptorStrand, boost::asio::ip::tcp::socket* newAsioSocket, const boost::system::error_code&, HandlerLock*);
+
+	bool MakeSendQueueRoom(size_t bytes);
+	void StartSend(HandlerLock* handlerLock);
+	void SendPostSendHandler(size_t buffersSent, size_t bytes, const boost::system::error_code& err, HandlerLock*);
+
+	void SendToPostResolveHandler(const boost::system::error_code&, ResolvedAddresses, size_t addressIndex, uint16_t port, char* buf, size_t bufLen, HandlerLock*);
+	void SendToPostSendHandler(ResolvedAddresses, size_t addressIndex, uint16_t port, char* buf, size_t bufLen, size_t bytesTransferred, const boost::system::error_code&, HandlerLock*);
+	void SendToEndpointPostSendHandler(Buffer* buf, size_t bytesTransferred, const boost::system::error_code&, HandlerLock*);
+	void SendToCompleted(size_t bytes);
 
 	//void InitializeResolver();
-	void InitializeSocket();
+	void InitializeSocket(const SocketType& protocol = SocketType::v4());
+	void ApplySocketOptions(typename SocketType::socket* asioSocket);
+	template <class AsioSocket> static bool SetSocketOption(AsioSocket* asioSocket, SM_SocketOption so, int value);
 
 	SM_SocketType sm_sockettype;
 	std::queue<SocketOption*> socketOptionQueue;
@@ -69,7 +147,102 @@ private:
 	boost::asio::ip::tcp::acceptor* tcpAcceptor;
 	boost::mutex* tcpAcceptorMutex;
 
+	// set from Connect() until the connect race finished, all guarded by socketMutex
+	bool connecting;
+	ConnectRace* connectRace;
+	uint32_t connectGeneration; // tells the resolve of the current Connect() from stale ones
+
+	/**
+	 * additional SO_REUSEPORT acceptors on the local endpoint, the kernel distributes the incoming
+	 * connections across tcpAcceptor and these
+	 *
+	 * Every shard accepts on its own io service run by a dedicated thread, the accepted sockets
+	 * are handed to the shared io service like tcpAcceptor's.
+	 */
+	struct ListenShard {
+		boost::asio::io_service* ioService;
+		boost::asio::io_service::work* ioServiceWork;
+		boost::thread* thread;
+		boost::asio::ip::tcp::acceptor* acceptor;
+		boost::asio::io_service::strand* strand;
+	};
+
+	unsigned int listenShards;
+	std::vector<ListenShard> tcpAcceptorShards;
+
+	unsigned int listenPendingAccepts; // concurrent async_accept()s per acceptor
+	int listenBacklog; // 0 for the OS default
+
+	/**
+	 * connected child sockets of a listening socket, shared with the children as either side may
+	 * be destroyed first
+	 */
+	struct AcceptedSockets {
+		AcceptedSockets() : peakCount(0), reapedCount(0) {}
+
+		boost::mutex mutex;
+		std::vector<Socket<SocketType>*> sockets;
+		size_t peakCount;
+		size_t reapedCount;
+	};
+
+	// limits for the accepted sockets, 0 if disabled
+	unsigned int listenMaxIdleTime;
+	unsigned int listenMaxConnections;
+
+	boost::shared_ptr<AcceptedSockets> acceptedSockets; // set once listening
+	boost::shared_ptr<AcceptedSockets> acceptedBy; // listener of an accepted socket
+	boost::atomic<uint64_t> lastActivityTick; // timer wheel tick of the last receive or send, accepted sockets only
+
 	boost::shared_mutex handlerMutex;
+
+	// serializes the completion handlers, the io service may be run by multiple threads
+	boost::asio::io_service::strand strand;
+
+	// data waiting to be written, sendInProgress is set while a write is running, both guarded by socketMutex
+	std::deque<Buffer*> sendQueue;
+	bool sendInProgress;
+	size_t sendInProgressCount; // buffers at the front of sendQueue being written
+
+	// send queue limits, sendQueueLowPending is set once the queue exceeded the low watermark
+	size_t sendQueueMaxBytes;
+	SM_SendQueueOverflow sendQueueOverflowPolicy;
+	size_t sendQueueLowWatermark;
+	bool sendQueueLowPending;
+
+	// try a non-blocking write on the calling thread if nothing is queued
+	bool sendInline;
+
+	// size of the buffers to read into, adapted to the read sizes if adaptiveReceiveChunkSize is set
+	size_t receiveChunkSize;
+	bool adaptiveReceiveChunkSize;
+	unsigned int smallReceiveCount;
+
+	// wait until the socket is readable before taking a receive buffer
+	bool receiveOnReadable;
+
+	// receive backpressure, reading pauses at the high and resumes at the low watermark
+	size_t receiveQueueHighWatermark;
+	size_t receiveQueueLowWatermark;
+	boost::atomic<size_t> receiveQueueLength; // received bytes not yet passed to the plugin
+	boost::atomic<bool> receivePaused;
+	HandlerLock* pausedReceiveHandlerLock;
+
+	/**
+	 * timeouts in milliseconds, 0 if disabled, and their deadlines in timer wheel ticks, guarded by
+	 * socketMutex
+	 *
+	 * Activity only moves the deadlines, TimeoutHandler() schedules itself again for the earliest
+	 * one at scheduledTimeoutTick.
+	 */
+	unsigned int connectTimeout;
+	unsigned int receiveTimeout;
+	unsigned int sendTimeout;
+	uint64_t connectDeadline;
+	uint64_t receiveDeadline;
+	uint64_t sendDeadline;
+	uint64_t reapDeadline; // next sweep of the accepted sockets
+	uint64_t scheduledTimeoutTick;
 };
 
 #endif
@@ -8,6 +8,11 @@
 
 using namespace boost::asio::ip;
 
+// socket ids are composed of the slot index in the lower and the slot generation in the upper bits
+#define SOCKETID_INDEX_BITS 20
+#define SOCKETID_INDEX_MASK ((1u << SOCKETID_INDEX_BITS) - 1)
+#define SOCKETID_GENERATION_MASK ((1u << (32 - SOCKETID_INDEX_BITS)) - 1)
+
 SocketWrapper::~SocketWrapper() {
 	switch (socketType) {
 		case SM_SocketType_Tcp:
@@ -29,12 +34,21 @@ SocketWrapper::~SocketWrapper() {
 template Socket<tcp>* SocketHandler::CreateSocket<tcp>(SM_SocketType);
 template Socket<udp>* SocketHandler::CreateSocket<udp>(SM_SocketType);
 
-SocketHandler::SocketHandler() : ioServiceProcessingThreadInitialized(false) {
+// upper limit for the IoThreads option
+#define MAX_IO_THREADS 32
+
+SocketHandler::SocketHandler() : receiveBufferBytes(0),
+								 sendRequests(0),
+								 sendOperations(0),
+								 sendQueueDroppedBytes(0),
+								 socketCount(0),
+								 ioServiceThreadCount(1),
+								 ioServiceProcessingThreadInitialized(false) {
 	ioService = new boost::asio::io_service();
 }
 
 SocketHandler::~SocketHandler() {
-	if (!socketList.empty() || ioServiceProcessingThreadInitialized) {
+	if (socketCount || ioServiceProcessingThreadInitialized) {
 		Shutdown();
 	}
 #ifndef WIN32
@@ -43,13 +57,20 @@ SocketHandler::~SocketHandler() {
 }
 
 void SocketHandler::Shutdown() {
-	boost::mutex::scoped_lock l(socketListMutex);
+	std::vector<SocketSlot> slots;
 
-	for (std::deque<SocketWrapper*>::iterator it=socketList.begin(); it!=socketList.end(); it++) {
-		delete *it;
-	}
+	{ // lock
+		boost::mutex::scoped_lock l(socketListMutex);
 
-	socketList.clear();
+		slots.swap(socketSlots);
+		freeSocketSlots.clear();
+		socketCount = 0;
+	} // ~lock
+
+	// handlers still running during the destruction may have to look up their socket
+	for (std::vector<SocketSlot>::iterator it=slots.begin(); it!=slots.end(); it++) {
+		if (it->socketWrapper) delete it->socketWrapper;
+	}
 
 	if (ioServiceProcessingThreadInitialized) StopProcessing();
 }
@@ -59,22 +80,44 @@ Socket<SocketType>* SocketHandler::CreateSocket(SM_SocketType st) {
 	boost::mutex::scoped_lock l(socketListMutex);
 
 	SocketWrapper* sp = new SocketWrapper(new Socket<SocketType>(st), st);
-	socketList.push_back(sp);
+	((Socket<SocketType>*) sp->socket)->socketId = AddSocketWrapper(sp);
 
 	return (Socket<SocketType>*) sp->socket;
 }
 
+uint32_t SocketHandler::AddSocketWrapper(SocketWrapper* sw) {
+	uint32_t index;
+
+	if (!freeSocketSlots.empty()) {
+		index = freeSocketSlots.back();
+		freeSocketSlots.pop_back();
+	} else {
+		index = socketSlots.size();
+		assert(index <= SOCKETID_INDEX_MASK);
+		socketSlots.push_back(SocketSlot());
+	}
+
+	socketSlots[index].socketWrapper = sw;
+	socketCount++;
+
+	sw->id = (socketSlots[index].generation << SOCKETID_INDEX_BITS) | index;
+
+	return sw->id;
+}
+
 void SocketHandler::DestroySocket(SocketWrapper* sw) {
 	assert(sw);
 
 	{ // lock
 		boost::mutex::scoped_lock l(socketListMutex);
 
-		for (std::deque<SocketWrapper*>::iterator it=socketList.begin(); it!=socketList.end(); it++) {
-			if (*it == sw) {
-				socketList.erase(it);
-				break;
-			}
+		uint32_t index = sw->id & SOCKETID_INDEX_MASK;
+
+		if (index < socketSlots.size() && socketSlots[index].socketWrapper == sw) {
+			socketSlots[index].socketWrapper = NULL;
+			socketSlots[index].generation = (socketSlots[index].generation + 1) & SOCKETID_GENERATION_MASK;
+			freeSocketSlots.push_back(index);
+			socketCount--;
 		}
 	} // ~lock
 
@@ -84,35 +127,75 @@ void SocketHandler::DestroySocket(SocketWrapper* sw) {
 void SocketHandler::StartProcessing() {
 	assert(!ioServiceProcessingThreadInitialized);
 
-	ioServiceProcessingThread = new boost::thread(boost::bind(&SocketHandler::RunIoService, this));
+	boost::mutex::scoped_lock l(ioServiceProcessingThreadsMutex);
+
+	ioServiceWork = new boost::asio::io_service::work(*ioService);
+
+	while (ioServiceProcessingThreads.size() < ioServiceThreadCount) {
+		ioServiceProcessingThreads.push_back(new boost::thread(boost::bind(&SocketHandler::RunIoService, this)));
+	}
+
 	ioServiceProcessingThreadInitialized = true;
 }
 
 void SocketHandler::StopProcessing() {
 	assert(ioServiceProcessingThreadInitialized);
 
+	boost::mutex::scoped_lock l(ioServiceProcessingThreadsMutex);
+
 	ioService->stop();
 	delete ioServiceWork;
-	ioServiceProcessingThread->join();
 
+	for (std::vector<boost::thread*>::iterator it=ioServiceProcessingThreads.begin(); it!=ioServiceProcessingThreads.end(); it++) {
+		(*it)->join();
+		delete *it;
+	}
+
+	ioServiceProcessingThreads.clear();
 	ioServiceProcessingThreadInitialized = false;
-	delete ioServiceProcessingThread;
 }
 
 void SocketHandler::RunIoService() {
-	//boost::asio::io_service::work work(*ioService);
-	ioServiceWork = new boost::asio::io_service::work(*ioService);
 	ioService->run();
 }
 
-SocketWrapper* SocketHandler::GetSocketWrapper(const void* socket) {
-	boost::mutex::scoped_lock l(socketListMutex);
+bool SocketHandler::SetOption(SM_SocketOption so, int value) {
+	switch (so) {
+		case SM_SO_IoThreads: {
+			boost::mutex::scoped_lock l(ioServiceProcessingThreadsMutex);
+
+			// running threads can't be taken out of the io service
+			if (value < 1 || value > MAX_IO_THREADS || (unsigned int) value < ioServiceProcessingThreads.size()) return false;
+
+			ioServiceThreadCount = value;
+
+			if (ioServiceProcessingThreadInitialized) {
+				while (ioServiceProcessingThreads.size() < ioServiceThreadCount) {
+					ioServiceProcessingThreads.push_back(new boost::thread(boost::bind(&SocketHandler::RunIoService, this)));
+				}
+			}
 
-	for (std::deque<SocketWrapper*>::iterator it=socketList.begin(); it!=socketList.end(); it++) {
-		if ((*it)->socket == socket) return *it;
+			return true;
+		}
+		default:
+			return false;
 	}
+}
+
+size_t SocketHandler::GetSocketCount() {
+	boost::mutex::scoped_lock l(socketListMutex);
+
+	return socketCount;
+}
+
+SocketWrapper* SocketHandler::GetSocketWrapper(uint32_t socketId) {
+	boost::mutex::scoped_lock l(socketListMutex);
+
+	uint32_t index = socketId & SOCKETID_INDEX_MASK;
+
+	if (index >= socketSlots.size() || socketSlots[index].generation != (socketId >> SOCKETID_INDEX_BITS)) return NULL;
 
-	return NULL;
+	return socketSlots[index].socketWrapper;
 }
 
 SocketHandler socketHandler;
@@ -1,18 +1,47 @@
 #ifndef INC_SEXT_SOCKETHANDLER_H
 #define INC_SEXT_SOCKETHANDLER_H
 
-#include <deque>
+#include <stdint.h>
+#include <vector>
 #include <boost/asio.hpp>
+#include <boost/atomic.hpp>
 #include <boost/thread.hpp>
 
 #include "Socket.h"
 
+class Callback;
+
 struct SocketWrapper {
-	SocketWrapper(void* socket, SM_SocketType socketType) : socket(socket), socketType(socketType) {}
+	SocketWrapper(void* socket, SM_SocketType socketType) : socket(socket),
+															socketType(socketType),
+															id(0),
+															pendingCallbacksHead(NULL),
+															pendingCallbacksTail(NULL),
+															readyPrev(NULL),
+															readyNext(NULL),
+															isReady(false),
+															callbackDeficit(0),
+															callbackQuantumGranted(false),
+															callbackPriority(1),
+															concatenateCallbacks(0),
+															batchIncomingCallbacks(false) {}
 	~SocketWrapper();
 
 	void* socket;
 	SM_SocketType socketType;
+	uint32_t id;
+
+	// callback dispatching, managed by CallbackHandler
+	Callback* pendingCallbacksHead;
+	Callback* pendingCallbacksTail;
+	SocketWrapper* readyPrev;
+	SocketWrapper* readyNext;
+	bool isReady;
+	long callbackDeficit;
+	bool callbackQuantumGranted;
+	unsigned int callbackPriority;
+	size_t concatenateCallbacks;
+	bool batchIncomingCallbacks;
 };
 
 class SocketHandler {
@@ -22,7 +51,7 @@ public:
 
 	void Shutdown();
 
-	SocketWrapper* GetSocketWrapper(const void* socket);
+	SocketWrapper* GetSocketWrapper(uint32_t socketId);
 
 	template <class SocketType> Socket<SocketType>* CreateSocket(SM_SocketType st);
 	void DestroySocket(SocketWrapper* sw);
@@ -30,16 +59,49 @@ public:
 	void StartProcessing();
 	void StopProcessing();
 
+	bool SetOption(SM_SocketOption so, int value);
+
+	size_t GetSocketCount();
+
+	// capacity of the receive buffers currently held by sockets
+	boost::atomic<size_t> receiveBufferBytes;
+
+	// sends requested by plugins and write operations issued for them
+	boost::atomic<uint32_t> sendRequests;
+	boost::atomic<uint32_t> sendOperations;
+	boost::atomic<uint32_t> sendQueueDroppedBytes;
+
 	//friend class Socket;
 	boost::asio::io_service* ioService;
 
 private:
-	std::deque<SocketWrapper*> socketList;
+	/**
+	 * slot map entry, the generation is incremented every time the slot is freed to detect stale ids
+	 */
+	struct SocketSlot {
+		SocketSlot() : socketWrapper(NULL), generation(0) {}
+
+		SocketWrapper* socketWrapper;
+		uint32_t generation;
+	};
+
+	uint32_t AddSocketWrapper(SocketWrapper* sw);
+
+	std::vector<SocketSlot> socketSlots;
+	std::vector<uint32_t> freeSocketSlots;
+	size_t socketCount;
 	boost::mutex socketListMutex;
 
 	boost::asio::io_service::work* ioServiceWork;
 
-	boost::thread* ioServiceProcessingThread;
+	/**
+	 * threads running the io service, every socket serializes its handlers with its own strand
+	 *
+	 * The pool can only grow while processing, ioServiceThreadCount is the requested size.
+	 */
+	std::vector<boost::thread*> ioServiceProcessingThreads;
+	unsigned int ioServiceThreadCount;
+	boost::mutex ioServiceProcessingThreadsMutex;
 	bool ioServiceProcessingThreadInitialized;
 
 	void RunIoService();
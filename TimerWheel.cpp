@@ -0,0 +1,166 @@
+#include "TimerWheel.h"
+
+#include <algorithm>
+#include <boost/bind.hpp>
+
+#include "SocketHandler.h"
+
+// resolution of the wheel in milliseconds and the number of slots, entries due further than a
+// full turn ahead stay in their slot for more rounds
+#define TIMER_WHEEL_TICK 100
+#define TIMER_WHEEL_SLOTS 512
+
+TimerWheel::TimerWheel() : slots(TIMER_WHEEL_SLOTS),
+						   entryCount(0),
+						   processedTick(0),
+						   startTime(boost::posix_time::microsec_clock::universal_time()),
+						   timer(NULL),
+						   timerRunning(false),
+						   firingOwner(NULL) {
+}
+
+TimerWheel::~TimerWheel() {
+	Shutdown();
+}
+
+uint64_t TimerWheel::GetCurrentTick() {
+	return (boost::posix_time::microsec_clock::universal_time() - startTime).total_milliseconds() / TIMER_WHEEL_TICK;
+}
+
+uint64_t TimerWheel::GetTicks(unsigned int ms) {
+	return (ms + TIMER_WHEEL_TICK - 1) / TIMER_WHEEL_TICK;
+}
+
+uint64_t TimerWheel::GetDeadline(unsigned int ms) {
+	// the current tick started up to a tick ago already
+	return GetCurrentTick() + GetTicks(ms) + 1;
+}
+
+void TimerWheel::Schedule(void* owner, uint64_t deadline, const Handler& handler) {
+	boost::mutex::scoped_lock l(wheelMutex);
+
+	// nothing is waiting for the ticks passed while idle
+	if (!timerRunning) processedTick = std::max(processedTick, GetCurrentTick());
+
+	if (deadline <= processedTick) deadline = processedTick + 1;
+
+	Entry entry;
+	entry.owner = owner;
+	entry.deadline = deadline;
+	entry.handler = handler;
+
+	slots[deadline % TIMER_WHEEL_SLOTS].push_back(entry);
+	entryCount++;
+
+	if (!timerRunning) StartTimer();
+}
+
+void TimerWheel::Cancel(void* owner) {
+	boost::mutex::scoped_lock l(wheelMutex);
+
+	// the running handler may schedule again before it returns
+	for (;;) {
+		for (std::vector<std::vector<Entry> >::iterator slot=slots.begin(); slot!=slots.end(); slot++) {
+			for (size_t i = 0; i < slot->size();) {
+				if ((*slot)[i].owner == owner) {
+					(*slot)[i] = slot->back();
+					slot->pop_back();
+					entryCount--;
+				} else {
+					i++;
+				}
+			}
+		}
+
+		for (std::vector<Entry>::iterator it=firing.begin(); it!=firing.end(); it++) {
+			if (it->owner == owner) it->owner = NULL;
+		}
+
+		if (firingOwner != owner) break;
+
+		firingDone.wait(l);
+	}
+}
+
+void TimerWheel::Shutdown() {
+	boost::mutex::scoped_lock l(wheelMutex);
+
+	if (timer) {
+		boost::system::error_code ignoredErrorCode;
+		timer->cancel(ignoredErrorCode);
+
+		delete timer;
+		timer = NULL;
+	}
+
+	timerRunning = false;
+
+	for (std::vector<std::vector<Entry> >::iterator slot=slots.begin(); slot!=slots.end(); slot++) {
+		slot->clear();
+	}
+
+	entryCount = 0;
+}
+
+/**
+ * wait for the next tick, wheelMutex has to be locked
+ */
+void TimerWheel::StartTimer() {
+	if (!timer) timer = new boost::asio::deadline_timer(*socketHandler.ioService);
+
+	timerRunning = true;
+
+	timer->expires_at(startTime + boost::posix_time::milliseconds((processedTick + 1) * TIMER_WHEEL_TICK));
+	timer->async_wait(boost::bind(&TimerWheel::TickHandler, this, boost::asio::placeholders::error));
+}
+
+void TimerWheel::TickHandler(const boost::system::error_code& errorCode) {
+	// cancelled by Shutdown()
+	if (errorCode) return;
+
+	boost::mutex::scoped_lock l(wheelMutex);
+
+	// catch up with the ticks missed by a busy io service
+	uint64_t currentTick = GetCurrentTick();
+
+	while (processedTick < currentTick) {
+		std::vector<Entry>& slot = slots[++processedTick % TIMER_WHEEL_SLOTS];
+
+		for (size_t i = 0; i < slot.size();) {
+			if (slot[i].deadline <= processedTick) {
+				firing.push_back(slot[i]);
+				slot[i] = slot.back();
+				slot.pop_back();
+				entryCount--;
+			} else {
+				i++;
+			}
+		}
+	}
+
+	// the handlers may schedule again, timerRunning stays set meanwhile
+	for (size_t i = 0; i < firing.size(); i++) {
+		if (!firing[i].owner) continue;
+
+		Handler handler;
+		handler.swap(firing[i].handler);
+		firingOwner = firing[i].owner;
+
+		l.unlock();
+		handler();
+		l.lock();
+
+		firingOwner = NULL;
+		firingDone.notify_all();
+	}
+
+	firing.clear();
+
+	if (entryCount && timer) {
+		StartTimer();
+	} else {
+		timerRunning = false;
+	}
+}
+
+TimerWheel timerWheel;
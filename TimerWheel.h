@@ -0,0 +1,79 @@
+#ifndef INC_SEXT_TIMERWHEEL_H
+#define INC_SEXT_TIMERWHEEL_H
+
+#include <stdint.h>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+/**
+ * hashed timer wheel shared by all sockets, a single deadline timer on the io service ticks
+ * while anything is scheduled
+ *
+ * Deadlines are counted in wheel ticks. Owners check their own deadlines when their handler is
+ * called and schedule again if they moved, refreshing a timeout doesn't touch the wheel.
+ */
+class TimerWheel {
+public:
+	typedef boost::function<void ()> Handler;
+
+	TimerWheel();
+	~TimerWheel();
+
+	uint64_t GetCurrentTick();
+
+	/**
+	 * @return ms milliseconds in ticks, rounded up
+	 */
+	static uint64_t GetTicks(unsigned int ms);
+
+	/**
+	 * @return tick a timeout of ms milliseconds starting now expires at, never early
+	 */
+	uint64_t GetDeadline(unsigned int ms);
+
+	/**
+	 * call handler on an io thread once deadline has passed
+	 */
+	void Schedule(void* owner, uint64_t deadline, const Handler& handler);
+
+	/**
+	 * drop all entries of owner, waits for its handler if it's running right now
+	 */
+	void Cancel(void* owner);
+
+	/**
+	 * release the timer, has to be called before the io service goes away
+	 */
+	void Shutdown();
+
+private:
+	struct Entry {
+		void* owner; // NULL once cancelled while waiting to be called
+		uint64_t deadline;
+		Handler handler;
+	};
+
+	void StartTimer();
+	void TickHandler(const boost::system::error_code& errorCode);
+
+	boost::mutex wheelMutex;
+	std::vector<std::vector<Entry> > slots;
+	size_t entryCount;
+	uint64_t processedTick;
+	boost::posix_time::ptime startTime;
+
+	boost::asio::deadline_timer* timer;
+	bool timerRunning;
+
+	// entries due in the tick being processed, firingOwner is the one whose handler is running
+	std::vector<Entry> firing;
+	void* firingOwner;
+	boost::condition_variable firingDone;
+};
+
+extern TimerWheel timerWheel;
+
+#endif
@@ -0,0 +1,125 @@
+/**
+ * accept rate benchmark, connections per second accepted by a listening socket with one or more
+ * ListenShards
+ *
+ * The socket listens through Socket::Listen(), every shard past the first accepts on a thread of
+ * its own. Local generator threads connect as fast as possible. Every run takes place in its own
+ * process, the accepted sockets are kept open until it exits.
+ */
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "Bench.h"
+#include "SocketHandler.h"
+
+using namespace boost::asio::ip;
+
+#define CONNECTIONS 5000
+#define GENERATORS 2
+
+/**
+ * connect, the connections stay open until the run is over, a connection reset before the accept
+ * completes gets no socket and closed ones would use up the local ports in TIME_WAIT
+ */
+static void Generate(boost::asio::io_service* ioService, tcp::endpoint endpoint, std::vector<tcp::socket*>* sockets, int connections) {
+	for (int i = 0; i < connections; i++) {
+		tcp::socket* socket = new tcp::socket(*ioService);
+		socket->connect(endpoint);
+		sockets->push_back(socket);
+	}
+}
+
+static int Run(int shardCount) {
+	// the accepted sockets stay open
+	rlimit limit;
+	getrlimit(RLIMIT_NOFILE, &limit);
+	limit.rlim_cur = limit.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &limit);
+
+	unsigned short port;
+
+	{
+		boost::asio::io_service ioService;
+		tcp::acceptor acceptor(ioService, tcp::endpoint(address_v4::loopback(), 0));
+		port = acceptor.local_endpoint().port();
+	}
+
+	socketHandler.StartProcessing();
+
+	Socket<tcp>* socket = socketHandler.CreateSocket<tcp>(SM_SocketType_Tcp);
+
+	if (!socket->SetOption(SM_SO_ListenShards, shardCount) || !socket->Bind("127.0.0.1", port, false) || !socket->Listen()) {
+		printf("%d shard(s)  listen failed\n", shardCount);
+		return 1;
+	}
+
+	tcp::endpoint endpoint(address_v4::loopback(), port);
+	uint64_t start = Now();
+
+	boost::asio::io_service ioService;
+	std::vector<tcp::socket*> sockets[GENERATORS];
+	boost::thread_group generators;
+
+	for (int i = 0; i < GENERATORS; i++) {
+		generators.create_thread(boost::bind(&Generate, &ioService, endpoint, &sockets[i], CONNECTIONS / GENERATORS));
+	}
+
+	// nothing is closed during the run, the accepted sockets take the slots following the listener
+	int accepted = 0;
+
+	while (accepted < CONNECTIONS) {
+		if (socketHandler.GetSocketWrapper(socket->socketId + accepted + 1)) {
+			accepted++;
+		} else {
+			boost::this_thread::yield();
+		}
+	}
+
+	double seconds = (Now() - start) / 1e9;
+	generators.join_all();
+
+	// reset instead of closing, keeps the ports out of TIME_WAIT
+	for (int i = 0; i < GENERATORS; i++) {
+		for (size_t j = 0; j < sockets[i].size(); j++) {
+			sockets[i][j]->set_option(boost::asio::socket_base::linger(true, 0));
+			sockets[i][j]->close();
+			delete sockets[i][j];
+		}
+	}
+
+	printf("%d shard(s)  %8.0f accepts/s\n", shardCount, accepted / seconds);
+
+	socketHandler.Shutdown();
+
+	return 0;
+}
+
+int main() {
+	int maxShards = std::max(2u, boost::thread::hardware_concurrency());
+	int shardCounts[] = {1, maxShards};
+	int ret = 0;
+
+	printf("%d connections from %d generator threads\n", CONNECTIONS, GENERATORS);
+	fflush(stdout);
+
+	for (size_t i = 0; i < sizeof(shardCounts) / sizeof(shardCounts[0]); i++) {
+		pid_t pid = fork();
+
+		if (pid == 0) {
+			int runRet = Run(shardCounts[i]);
+			fflush(stdout);
+			_exit(runRet);
+		}
+
+		int status = 1;
+		if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status)) ret = 1;
+	}
+
+	return ret;
+}
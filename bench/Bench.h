@@ -0,0 +1,54 @@
+#ifndef INC_SEXT_BENCH_H
+#define INC_SEXT_BENCH_H
+
+#include <stdint.h>
+#include <time.h>
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+/**
+ * helpers shared by the benchmarks, the results are printed to stdout one line per variant
+ */
+
+/**
+ * @return current time of clock in nanoseconds
+ */
+static inline uint64_t Now(clockid_t clock = CLOCK_MONOTONIC) {
+	timespec ts;
+	clock_gettime(clock, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * sleep until deadline, in CLOCK_MONOTONIC nanoseconds
+ */
+static inline void SleepUntil(uint64_t deadline) {
+	timespec ts;
+	ts.tv_sec = deadline / 1000000000;
+	ts.tv_nsec = deadline % 1000000000;
+
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+/**
+ * sort the samples and print their percentiles, ends the line
+ */
+static inline void PrintPercentiles(std::vector<uint32_t>& samples, const char* unit) {
+	if (samples.empty()) {
+		printf("no samples\n");
+		return;
+	}
+
+	std::sort(samples.begin(), samples.end());
+
+	printf("p50=%u%s p90=%u%s p99=%u%s p99.9=%u%s max=%u%s\n",
+		   samples[samples.size() / 2], unit,
+		   samples[samples.size() * 9 / 10], unit,
+		   samples[samples.size() * 99 / 100], unit,
+		   samples[samples.size() * 999 / 1000], unit,
+		   samples.back(), unit);
+}
+
+#endif
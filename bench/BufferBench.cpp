@@ -0,0 +1,94 @@
+/**
+ * receive path benchmark, bytes per second a single core moves from the read buffer to the
+ * plugin for a given chunk size (the buffer capacity, including the \0 terminator)
+ *
+ * The copy path is the one replaced by pooled buffers: the chunk went into a std::string for the
+ * callback, into a temporary array for the call and into the plugin heap. The buffer path reads
+ * into a pooled Buffer and copies once into the plugin heap.
+ */
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "Bench.h"
+#include "Buffer.h"
+
+#define TOTAL_BYTES (1024 * 1024 * 1024)
+
+// the socket read, the same for both paths
+static void Read(char* dest, const std::vector<char>& source, size_t length) {
+	memcpy(dest, &source[0], length);
+}
+
+static size_t RunCopies(const std::vector<char>& source, size_t chunkSize, std::vector<char>& pluginHeap) {
+	std::vector<char> readBuffer(chunkSize);
+	size_t checksum = 0;
+
+	size_t length = chunkSize-1;
+
+	for (size_t bytes = 0; bytes < TOTAL_BYTES; bytes += length) {
+		Read(&readBuffer[0], source, length);
+
+		std::string* data = new std::string(&readBuffer[0], length);
+
+		char* tmp = new char[data->length()+1];
+		memcpy(tmp, data->c_str(), data->length()+1);
+
+		memcpy(&pluginHeap[0], tmp, data->length()+1);
+		checksum += pluginHeap[chunkSize / 2];
+
+		delete[] tmp;
+		delete data;
+	}
+
+	return checksum;
+}
+
+static size_t RunBuffers(const std::vector<char>& source, size_t chunkSize, std::vector<char>& pluginHeap) {
+	size_t checksum = 0;
+
+	size_t length = chunkSize-1;
+
+	for (size_t bytes = 0; bytes < TOTAL_BYTES; bytes += length) {
+		Buffer* buf = Buffer::Create(chunkSize);
+		Read(buf->GetData(), source, length);
+		buf->SetLength(length);
+		buf->GetData()[length] = '\0';
+
+		memcpy(&pluginHeap[0], buf->GetData(), buf->GetLength()+1);
+		checksum += pluginHeap[chunkSize / 2];
+
+		buf->Release();
+	}
+
+	return checksum;
+}
+
+int main() {
+	static const size_t chunkSizes[] = {512, 4096, 16384, 65536};
+	size_t checksum = 0;
+
+	printf("%d MB per run\n", TOTAL_BYTES / (1024 * 1024));
+
+	for (size_t i = 0; i < sizeof(chunkSizes) / sizeof(chunkSizes[0]); i++) {
+		size_t chunkSize = chunkSizes[i];
+		std::vector<char> source(chunkSize, 'x');
+		std::vector<char> pluginHeap(chunkSize);
+
+		uint64_t start = Now();
+		checksum += RunCopies(source, chunkSize, pluginHeap);
+		double copySeconds = (Now() - start) / 1e9;
+
+		start = Now();
+		checksum += RunBuffers(source, chunkSize, pluginHeap);
+		double bufferSeconds = (Now() - start) / 1e9;
+
+		printf("chunk %6zu  copies %7.2f GB/s  buffers %7.2f GB/s\n",
+			   chunkSize,
+			   TOTAL_BYTES / copySeconds / 1e9,
+			   TOTAL_BYTES / bufferSeconds / 1e9);
+	}
+
+	return checksum ? 0 : 1;
+}
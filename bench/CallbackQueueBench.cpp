@@ -0,0 +1,100 @@
+/**
+ * callback queue benchmark, io threads push while the game thread drains once per frame
+ *
+ * Compares CallbackQueue with the mutex protected deque it replaced. The game thread stall is
+ * the time a single fetch takes, which includes waiting for the producers' lock with the mutex.
+ */
+#include <cstdio>
+#include <deque>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "Bench.h"
+#include "CallbackQueue.h"
+
+#define PRODUCERS 4
+#define ITEMS_PER_PRODUCER 1000000
+
+struct Item : public CallbackQueueNode {};
+
+class MutexQueue {
+public:
+	void Push(Item* item) {
+		boost::mutex::scoped_lock l(mutex);
+		items.push_back(item);
+	}
+
+	Item* Pop() {
+		boost::mutex::scoped_lock l(mutex);
+
+		if (items.empty()) return NULL;
+
+		Item* ret = items.front();
+		items.pop_front();
+		return ret;
+	}
+
+private:
+	boost::mutex mutex;
+	std::deque<Item*> items;
+};
+
+class LockFreeQueue {
+public:
+	void Push(Item* item) {
+		queue.Push(item);
+	}
+
+	Item* Pop() {
+		return static_cast<Item*>(queue.Pop());
+	}
+
+private:
+	CallbackQueue<Item> queue;
+};
+
+template <class Queue>
+static void Produce(Queue* queue, Item* items) {
+	for (size_t i = 0; i < ITEMS_PER_PRODUCER; i++) queue->Push(&items[i]);
+}
+
+template <class Queue>
+static void Run(const char* name) {
+	Queue queue;
+	std::vector<Item> items(PRODUCERS * ITEMS_PER_PRODUCER);
+	std::vector<uint32_t> fetchTimes; // ns per pop, including the ones finding the queue empty
+	fetchTimes.reserve(items.size() + 1024);
+
+	boost::thread_group producers;
+	uint64_t start = Now();
+
+	for (int i = 0; i < PRODUCERS; i++) {
+		producers.create_thread(boost::bind(&Produce<Queue>, &queue, &items[i * ITEMS_PER_PRODUCER]));
+	}
+
+	size_t popped = 0;
+
+	while (popped < items.size()) {
+		uint64_t before = Now();
+		Item* item = queue.Pop();
+		fetchTimes.push_back((uint32_t) (Now() - before));
+
+		if (item) popped++;
+	}
+
+	double seconds = (Now() - start) / 1e9;
+	producers.join_all();
+
+	printf("%-10s %6.2f Mitems/s  pop ", name, popped / seconds / 1e6);
+	PrintPercentiles(fetchTimes, "ns");
+}
+
+int main() {
+	printf("%d producers, %d items each\n", PRODUCERS, ITEMS_PER_PRODUCER);
+
+	Run<MutexQueue>("mutex");
+	Run<LockFreeQueue>("lock-free");
+
+	return 0;
+}
@@ -0,0 +1,85 @@
+/**
+ * inline send benchmark, latency from the send call to the arrival at the peer over loopback
+ *
+ * A heartbeat is sent every millisecond through Socket::Send() of a socket connected over
+ * loopback, once with the write left to the io thread and once with the SendInline option set.
+ * The peer reads on its own thread and takes the arrival time.
+ */
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "Bench.h"
+#include "SocketHandler.h"
+
+using namespace boost::asio::ip;
+
+#define MESSAGE_SIZE 64
+#define ROUNDS 5000
+
+static void Receive(tcp::socket* socket, std::vector<uint32_t>* latencies) {
+	char message[MESSAGE_SIZE];
+
+	for (int i = 0; i < ROUNDS; i++) {
+		boost::asio::read(*socket, boost::asio::buffer(message, sizeof(message)));
+
+		uint64_t sendTime;
+		memcpy(&sendTime, message, sizeof(sendTime));
+		latencies->push_back((uint32_t) (Now() - sendTime));
+	}
+}
+
+static bool Run(const char* name, bool sendInline) {
+	boost::asio::io_service ioService;
+	tcp::acceptor acceptor(ioService, tcp::endpoint(address_v4::loopback(), 0));
+	tcp::socket peer(ioService);
+
+	Socket<tcp>* socket = socketHandler.CreateSocket<tcp>(SM_SocketType_Tcp);
+
+	if (!socket->SetOption(SM_SO_SendInline, sendInline) || !socket->Connect("127.0.0.1", acceptor.local_endpoint().port(), false)) {
+		printf("%-7s setup failed\n", name);
+		return false;
+	}
+
+	acceptor.accept(peer);
+
+	std::vector<uint32_t> latencies;
+	latencies.reserve(ROUNDS);
+	boost::thread receiveThread(boost::bind(&Receive, &peer, &latencies));
+
+	char message[MESSAGE_SIZE];
+	memset(message, 'x', sizeof(message));
+
+	uint64_t start = Now();
+
+	for (int round = 0; round < ROUNDS; round++) {
+		uint64_t sendTime = Now();
+		memcpy(message, &sendTime, sizeof(sendTime));
+
+		socket->Send(Buffer::Create(message, sizeof(message)));
+
+		SleepUntil(start + (uint64_t) (round + 1) * 1000000);
+	}
+
+	receiveThread.join();
+	socketHandler.DestroySocket(socketHandler.GetSocketWrapper(socket->socketId));
+
+	printf("%-7s ", name);
+	PrintPercentiles(latencies, "ns");
+
+	return true;
+}
+
+int main() {
+	printf("%d %d byte heartbeats, 1 ms apart\n", ROUNDS, MESSAGE_SIZE);
+
+	socketHandler.StartProcessing();
+
+	bool ok = Run("queued", false) && Run("inline", true);
+
+	socketHandler.Shutdown();
+
+	return ok ? 0 : 1;
+}
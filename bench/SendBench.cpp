@@ -0,0 +1,84 @@
+/**
+ * send path benchmark, game thread cpu time for 1 KB messages at 50k/s
+ *
+ * Every message takes the path of the SocketSend native: the plugin string is copied into a
+ * pooled Buffer and handed to Socket::Send() of a socket connected over loopback, whose peer
+ * drains the data on its own thread.
+ */
+#include <cstdio>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "Bench.h"
+#include "SocketHandler.h"
+
+using namespace boost::asio::ip;
+
+#define MESSAGE_SIZE 1024
+#define MESSAGES_PER_SECOND 50000
+#define MESSAGES_PER_MS (MESSAGES_PER_SECOND / 1000)
+#define DURATION_MS 2000
+
+static void Drain(tcp::socket* socket) {
+	std::vector<char> buf(65536);
+	boost::system::error_code errorCode;
+
+	while (!errorCode) socket->read_some(boost::asio::buffer(buf), errorCode);
+}
+
+int main() {
+	boost::asio::io_service ioService;
+	tcp::acceptor acceptor(ioService, tcp::endpoint(address_v4::loopback(), 0));
+	tcp::socket peer(ioService);
+
+	socketHandler.StartProcessing();
+
+	Socket<tcp>* socket = socketHandler.CreateSocket<tcp>(SM_SocketType_Tcp);
+
+	if (!socket->Connect("127.0.0.1", acceptor.local_endpoint().port(), false)) {
+		printf("connect failed\n");
+		return 1;
+	}
+
+	acceptor.accept(peer);
+
+	boost::thread drainThread(boost::bind(&Drain, &peer));
+
+	std::vector<char> pluginString(MESSAGE_SIZE, 'x');
+	size_t failed = 0;
+
+	uint64_t wallStart = Now();
+	uint64_t cpu = 0;
+
+	for (int ms = 0; ms < DURATION_MS; ms++) {
+		uint64_t cpuStart = Now(CLOCK_THREAD_CPUTIME_ID);
+
+		for (int i = 0; i < MESSAGES_PER_MS; i++) {
+			if (!socket->Send(Buffer::Create(&pluginString[0], MESSAGE_SIZE))) failed++;
+		}
+
+		cpu += Now(CLOCK_THREAD_CPUTIME_ID) - cpuStart;
+
+		SleepUntil(wallStart + (uint64_t) (ms + 1) * 1000000);
+	}
+
+	double wall = Now() - wallStart;
+	size_t messages = (size_t) MESSAGES_PER_MS * DURATION_MS;
+
+	// closing the socket ends the drain once everything has been written
+	while (socket->sendQueueLength) boost::this_thread::yield();
+
+	socketHandler.DestroySocket(socketHandler.GetSocketWrapper(socket->socketId));
+	drainThread.join();
+
+	printf("%d byte messages at %d/s for %d ms\n", MESSAGE_SIZE, MESSAGES_PER_SECOND, DURATION_MS);
+	printf("Send()  %5.2f%% game thread cpu, %.0f ns per message (%zu failed)\n",
+		   cpu / wall * 100,
+		   (double) cpu / messages,
+		   failed);
+
+	socketHandler.Shutdown();
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,53 @@
+/**
+ * socket lookup benchmark, SocketHandler::GetSocketWrapper() with 5000 live sockets
+ *
+ * The sockets are created through the socket handler without being opened, half of them are
+ * closed and created again first so the slots are a generation in. Lookups hit random live
+ * sockets, like the callbacks created for received data.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "Bench.h"
+#include "SocketHandler.h"
+
+using namespace boost::asio::ip;
+
+#define SOCKETS 5000
+#define LOOKUPS 1000000
+
+int main() {
+	std::vector<uint32_t> socketIds;
+
+	for (int i = 0; i < SOCKETS; i++) {
+		socketIds.push_back(socketHandler.CreateSocket<tcp>(SM_SocketType_Tcp)->socketId);
+	}
+
+	for (int i = 0; i < SOCKETS; i += 2) {
+		socketHandler.DestroySocket(socketHandler.GetSocketWrapper(socketIds[i]));
+		socketIds[i] = socketHandler.CreateSocket<tcp>(SM_SocketType_Tcp)->socketId;
+	}
+
+	std::vector<uint32_t> lookups(LOOKUPS);
+	srand(1);
+
+	for (size_t i = 0; i < lookups.size(); i++) lookups[i] = socketIds[rand() % SOCKETS];
+
+	printf("%d live sockets, %d lookups\n", SOCKETS, LOOKUPS);
+
+	size_t found = 0;
+	uint64_t start = Now();
+
+	for (size_t i = 0; i < lookups.size(); i++) {
+		if (socketHandler.GetSocketWrapper(lookups[i])) found++;
+	}
+
+	double ns = (double) (Now() - start) / lookups.size();
+
+	printf("GetSocketWrapper %7.1f ns/lookup  %10.0f lookups/s  (%zu found)\n", ns, 1e9 / ns, found);
+
+	socketHandler.Shutdown();
+
+	return (found == lookups.size()) ? 0 : 1;
+}